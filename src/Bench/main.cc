@@ -0,0 +1,387 @@
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "context.h"
+#include "icosphere.h"
+#include "job_system.h"
+#include "stream_buffer.h"
+
+// Benchmarks of the hot paths the demos share, written to a JSON or CSV
+// file so results can be compared between commits:
+//
+//   gltest_bench [--filter=SUBSTRING] [--output=FILE] [--no-gl]
+//
+// Every benchmark has a name like "icosphere/make/level:5", a mean time per
+// run and a throughput in millions of items per second.
+
+namespace {
+const char *kUsage = "usage: gltest_bench [--filter=SUBSTRING] "
+                     "[--output=FILE.json|FILE.csv] [--no-gl]";
+
+// Keeps results alive so the compiler cannot drop the work producing them.
+volatile float sink;
+
+struct Result {
+  std::string name;
+  double milliseconds;
+  int runs;
+  // millions of `unit` per second
+  double rate;
+  std::string unit;
+};
+
+class Suite {
+public:
+  explicit Suite(std::string filter) : filter_(std::move(filter)) {}
+
+  // Runs `run` once to warm up, then repeatedly for at least `budget`
+  // seconds, and records its mean time. One run processes `items` of
+  // `unit`. A run that calls Fail ends the benchmark, which records
+  // nothing.
+  template <typename F>
+  void Run(const std::string &name, double items, const char *unit, F run,
+           double budget = 0.25) {
+    if (name.find(filter_) == std::string::npos)
+      return;
+    using Clock = std::chrono::steady_clock;
+
+    failed_ = false;
+    run();
+    int runs = 0;
+    auto start = Clock::now();
+    std::chrono::duration<double, std::milli> elapsed{};
+    while (!failed_) {
+      run();
+      ++runs;
+      elapsed = Clock::now() - start;
+      if (elapsed.count() >= budget * 1000.0)
+        break;
+    }
+    if (failed_) {
+      spdlog::error("{} failed: {}", name, failure_);
+      ++failures_;
+      return;
+    }
+
+    double milliseconds = elapsed.count() / runs;
+    Result result{name, milliseconds, runs, items / milliseconds / 1000.0,
+                  std::string("M") + unit + "/s"};
+    spdlog::info("{:<36} {:>11.4f} ms {:>8} runs {:>11.2f} {}", result.name,
+                 result.milliseconds, result.runs, result.rate, result.unit);
+    results_.push_back(std::move(result));
+  }
+
+  // Abandons the benchmark being run, for `reason`.
+  void Fail(std::string reason) {
+    failed_ = true;
+    failure_ = std::move(reason);
+  }
+  int failures() const { return failures_; }
+
+  // Writes the results as JSON when `path` ends in ".json", CSV otherwise.
+  bool Write(const std::string &path, const std::string &renderer) const;
+
+private:
+  std::string filter_;
+  std::vector<Result> results_;
+  bool failed_ = false;
+  std::string failure_;
+  int failures_ = 0;
+};
+
+std::string JsonString(const std::string &value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+bool Suite::Write(const std::string &path, const std::string &renderer) const {
+  std::ofstream file(path, std::ios::trunc);
+  const std::string json = ".json";
+  if (path.size() >= json.size() &&
+      path.compare(path.size() - json.size(), json.size(), json) == 0) {
+    file << "{\"renderer\": " << JsonString(renderer)
+         << ", \"benchmarks\": [\n";
+    for (size_t i = 0; i < results_.size(); ++i) {
+      auto &result = results_[i];
+      file << fmt::format("{{\"name\": {}, \"ms\": {:.6f}, \"runs\": {}, "
+                          "\"rate\": {:.4f}, \"unit\": {}}}{}\n",
+                          JsonString(result.name), result.milliseconds,
+                          result.runs, result.rate, JsonString(result.unit),
+                          i + 1 < results_.size() ? "," : "");
+    }
+    file << "]}\n";
+  } else {
+    file << "name,ms,runs,rate,unit\n";
+    for (auto &result : results_)
+      file << fmt::format("{},{:.6f},{},{:.4f},{}\n", result.name,
+                          result.milliseconds, result.runs, result.rate,
+                          result.unit);
+  }
+  if (!file) {
+    spdlog::error("could not write benchmark results to {}", path);
+    return false;
+  }
+  spdlog::info("wrote {} results to {}", results_.size(), path);
+  return true;
+}
+
+void BenchIcosphere(Suite &suite) {
+  for (int level = 0; level <= 8; ++level) {
+    icosahedron::VisitIndexType(level, [&suite, level](auto type) {
+      using Index = typename decltype(type)::type;
+      suite.Run(fmt::format("icosphere/make/level:{}", level),
+                icosahedron::VertexCount(level), "vert", [level] {
+                  auto mesh = icosahedron::MakeIcosphere<Index>(level);
+                  sink = mesh.first.back().x;
+                });
+    });
+  }
+}
+
+// A test image with smooth gradients and some noise, so it compresses
+// roughly like a photo rather than like a flat colour.
+std::vector<unsigned char> MakeImage(int size, int channels) {
+  std::vector<unsigned char> pixels(size_t(size) * size * channels);
+  uint32_t state = 0x9e3779b9u;
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      for (int c = 0; c < channels; ++c) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int gradient = (x * (c + 1) + y * (3 - c % 3)) * 255 / (4 * size);
+        pixels[(size_t(y) * size + x) * channels + c] =
+            static_cast<unsigned char>(gradient + (state & 15));
+      }
+    }
+  }
+  return pixels;
+}
+
+// stb_image_write callback collecting the encoded file in memory
+void AppendToVector(void *context, void *data, int size) {
+  auto *file = static_cast<std::vector<unsigned char> *>(context);
+  auto *bytes = static_cast<unsigned char *>(data);
+  file->insert(file->end(), bytes, bytes + size);
+}
+
+void BenchImageDecode(Suite &suite) {
+  for (int size : {256, 1024, 2048}) {
+    for (int channels : {1, 3, 4}) {
+      auto pixels = MakeImage(size, channels);
+      std::vector<unsigned char> png, jpg;
+      stbi_write_png_to_func(AppendToVector, &png, size, size, channels,
+                             pixels.data(), size * channels);
+      stbi_write_jpg_to_func(AppendToVector, &jpg, size, size, channels,
+                             pixels.data(), 90);
+
+      for (auto [format, encoded] :
+           {std::make_pair("png", &png), std::make_pair("jpg", &jpg)}) {
+        suite.Run(
+            fmt::format("stb/decode/{}/{}x{}x{}", format, size, size,
+                        channels),
+            pixels.size(), "B", [encoded, channels] {
+              int width = 0, height = 0, components = 0;
+              stbi_uc *decoded = stbi_load_from_memory(
+                  encoded->data(), encoded->size(), &width, &height,
+                  &components, channels);
+              sink = decoded ? decoded[0] : 0;
+              stbi_image_free(decoded);
+            });
+      }
+    }
+  }
+}
+
+void BenchMvp(Suite &suite) {
+  const size_t count = 1 << 14;
+  std::vector<glm::mat4> models(count), mvps(count);
+  for (size_t i = 0; i < count; ++i)
+    models[i] =
+        glm::translate(glm::vec3(i % 128, i / 128 % 128, 0.0f)) *
+        glm::rotate(0.01f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(4.0f, 3.0f, 3.0f),
+                               glm::vec3(0.0f, 0.0f, 0.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+
+  // what the demos do: projection * view * model for every object
+  suite.Run("mvp/compose/per_object", count, "mat", [&] {
+    for (size_t i = 0; i < count; ++i)
+      mvps[i] = projection * view * models[i];
+    sink = mvps[count - 1][3][3];
+  });
+  suite.Run("mvp/compose/hoisted", count, "mat", [&] {
+    glm::mat4 view_projection = projection * view;
+    for (size_t i = 0; i < count; ++i)
+      mvps[i] = view_projection * models[i];
+    sink = mvps[count - 1][3][3];
+  });
+  // including the per-frame rotation of the spinning demos
+  suite.Run("mvp/rotate_compose", count, "mat", [&] {
+    glm::mat4 view_projection = projection * view;
+    for (size_t i = 0; i < count; ++i)
+      mvps[i] = view_projection *
+                glm::rotate(0.01f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+    sink = mvps[count - 1][3][3];
+  });
+}
+
+// The per-frame transform update of the Cube demo, spread over job systems
+// of growing size to show how it scales with cores.
+void BenchJobs(Suite &suite) {
+  const size_t count = 100000;
+  const size_t grain = 1024;
+  std::vector<glm::mat4> mvps(count);
+  glm::mat4 view_projection =
+      glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+      glm::lookAt(glm::vec3(4.0f, 3.0f, 3.0f), glm::vec3(0.0f, 0.0f, 0.0f),
+                  glm::vec3(0.0f, 1.0f, 0.0f));
+  // one function object for every variant, so only the scheduling differs
+  JobSystem::Body update = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      mvps[i] = view_projection *
+                glm::translate(glm::vec3(i % 316, i / 316, 0.0f)) *
+                glm::rotate(0.1f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+  };
+
+  suite.Run("jobs/transforms/serial", count, "mat", [&] {
+    update(0, count);
+    sink = mvps[count - 1][3][3];
+  });
+  // powers of two below the core count, then the core count itself
+  unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<unsigned> thread_counts;
+  for (unsigned threads = 1; threads < cores; threads *= 2)
+    thread_counts.push_back(threads);
+  thread_counts.push_back(cores);
+  for (unsigned threads : thread_counts) {
+    JobSystem jobs(threads);
+    suite.Run(fmt::format("jobs/transforms/threads:{}", threads), count,
+              "mat", [&] {
+                jobs.ParallelFor(count, grain, update);
+                sink = mvps[count - 1][3][3];
+              });
+  }
+}
+
+void BenchUpload(Suite &suite) {
+  // every run streams this much in chunks of each size, then waits for GL
+  const size_t total = size_t(16) << 20;
+  std::vector<unsigned char> data(total, 0x5a);
+
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  LabelObject(GL_BUFFER, buffer, "upload benchmark");
+  for (size_t size : {size_t(64) << 10, size_t(1) << 20, size_t(16) << 20}) {
+    size_t chunks = total / size;
+    std::string label = size < (size_t(1) << 20)
+                            ? fmt::format("{}KiB", size >> 10)
+                            : fmt::format("{}MiB", size >> 20);
+
+    suite.Run("upload/buffer_data/" + label, total, "B", [&] {
+      for (size_t chunk = 0; chunk < chunks; ++chunk)
+        glBufferData(GL_ARRAY_BUFFER, size, data.data() + chunk * size,
+                     GL_STREAM_DRAW);
+      glFinish();
+    });
+
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    suite.Run("upload/map_range/" + label, total, "B", [&] {
+      for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        void *mapped = glMapBufferRange(
+            GL_ARRAY_BUFFER, 0, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        std::memcpy(mapped, data.data() + chunk * size, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+      }
+      glFinish();
+    });
+
+    // persistently mapped, fenced regions; no map calls at all
+    StreamBuffer stream(size);
+    LabelObject(GL_BUFFER, stream.buffer(), "stream benchmark");
+    suite.Run("upload/stream_buffer/" + label, total, "B", [&] {
+      for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        stream.Begin();
+        auto allocation = stream.Allocate(size, 1);
+        if (!allocation.data) {
+          stream.End();
+          suite.Fail("could not map the stream buffer");
+          break;
+        }
+        std::memcpy(allocation.data, data.data() + chunk * size, size);
+        stream.End();
+      }
+      glFinish();
+    });
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &buffer);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  ContextOptions options;
+  options.headless = true;
+  if (!ParseContextOptions(argc, argv, options))
+    return 1;
+
+  std::string filter;
+  std::string output = "gltest_bench.json";
+  bool gl = true;
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+    if (argument.rfind("--filter=", 0) == 0) {
+      filter = argument.substr(std::strlen("--filter="));
+    } else if (argument.rfind("--output=", 0) == 0) {
+      output = argument.substr(std::strlen("--output="));
+    } else if (argument == "--no-gl") {
+      gl = false;
+    } else {
+      spdlog::error(kUsage);
+      return 1;
+    }
+  }
+
+  Suite suite(filter);
+  BenchIcosphere(suite);
+  BenchImageDecode(suite);
+  BenchMvp(suite);
+  BenchJobs(suite);
+
+  std::string renderer;
+  if (gl) {
+    auto context = Context::Create(options, "gltest_bench");
+    if (context) {
+      renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+      BenchUpload(suite);
+    } else {
+      spdlog::warn("no GL context, skipping the upload benchmarks");
+    }
+  }
+
+  bool written = suite.Write(output, renderer);
+  return written && suite.failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,539 @@
+#include "block_compression.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSION_SSE2
+#endif
+
+namespace {
+constexpr int kTexels = kBlockSize * kBlockSize;
+
+// weights of the second endpoint for each index, out of 3 and of 64
+const float kBC1Weights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+const int kBC7Weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                             34, 38, 43, 47, 51, 55, 60, 64};
+
+// The texels of a block, row by row, as RGBA.
+struct Block {
+  uint8_t texels[kTexels][4];
+};
+
+// Appends values to a little-endian bit stream, lowest bit first, as
+// BC7 blocks are laid out. The output must start zeroed.
+class BitWriter {
+public:
+  explicit BitWriter(unsigned char *out) : out_(out) {}
+
+  void Put(uint32_t value, int bits) {
+    for (int i = 0; i < bits; ++i, ++position_)
+      if (value >> i & 1)
+        out_[position_ / 8] |= 1 << position_ % 8;
+  }
+
+private:
+  unsigned char *out_;
+  int position_ = 0;
+};
+
+void LoadBlock(const unsigned char *rgba, int width, int height, int column,
+               int row, Block *block) {
+  for (int y = 0; y < kBlockSize; ++y) {
+    int texel_row = std::min(row * kBlockSize + y, height - 1);
+    for (int x = 0; x < kBlockSize; ++x) {
+      int texel_column = std::min(column * kBlockSize + x, width - 1);
+      std::memcpy(block->texels[y * kBlockSize + x],
+                  rgba + (size_t(texel_row) * width + texel_column) * 4, 4);
+    }
+  }
+}
+
+// Picks the nearest of `count` palette colors for every texel, by squared
+// distance over all four channels, and returns the summed distance. Ties go
+// to the lower index.
+#if defined(BLOCK_COMPRESSION_SSE2)
+// Four texels at a time. Channels are widened to 16 bits, so
+// _mm_madd_epi16 squares and pairs them without overflow, and the results
+// match the plain loop below exactly.
+uint32_t SelectIndices(const uint8_t texels[kTexels][4],
+                       const uint8_t palette[][4], int count,
+                       uint8_t indices[kTexels]) {
+  const __m128i zero = _mm_setzero_si128();
+  // two texels per register
+  __m128i pairs[kTexels / 2];
+  for (int i = 0; i < kTexels / 2; ++i)
+    pairs[i] = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(texels[2 * i])),
+        zero);
+  // four texels per register
+  __m128i best[kTexels / 4];
+  __m128i best_index[kTexels / 4];
+  for (int group = 0; group < kTexels / 4; ++group) {
+    best[group] = _mm_set1_epi32(INT_MAX);
+    best_index[group] = zero;
+  }
+  for (int entry = 0; entry < count; ++entry) {
+    int32_t color;
+    std::memcpy(&color, palette[entry], 4);
+    __m128i target = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+    __m128i index = _mm_set1_epi32(entry);
+    for (int group = 0; group < kTexels / 4; ++group) {
+      __m128i first = _mm_sub_epi16(pairs[2 * group], target);
+      __m128i second = _mm_sub_epi16(pairs[2 * group + 1], target);
+      // red plus green and blue plus alpha of each texel
+      __m128 first_sums = _mm_castsi128_ps(_mm_madd_epi16(first, first));
+      __m128 second_sums = _mm_castsi128_ps(_mm_madd_epi16(second, second));
+      __m128i distance = _mm_add_epi32(
+          _mm_castps_si128(_mm_shuffle_ps(first_sums, second_sums,
+                                          _MM_SHUFFLE(2, 0, 2, 0))),
+          _mm_castps_si128(_mm_shuffle_ps(first_sums, second_sums,
+                                          _MM_SHUFFLE(3, 1, 3, 1))));
+      __m128i closer = _mm_cmplt_epi32(distance, best[group]);
+      best[group] = _mm_or_si128(_mm_and_si128(closer, distance),
+                                 _mm_andnot_si128(closer, best[group]));
+      best_index[group] = _mm_or_si128(
+          _mm_and_si128(closer, index),
+          _mm_andnot_si128(closer, best_index[group]));
+    }
+  }
+  uint32_t total = 0;
+  for (int group = 0; group < kTexels / 4; ++group) {
+    alignas(16) int32_t distances[4];
+    alignas(16) int32_t group_indices[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(distances), best[group]);
+    _mm_store_si128(reinterpret_cast<__m128i *>(group_indices),
+                    best_index[group]);
+    for (int i = 0; i < 4; ++i) {
+      indices[4 * group + i] = group_indices[i];
+      total += distances[i];
+    }
+  }
+  return total;
+}
+#else
+uint32_t SelectIndices(const uint8_t texels[kTexels][4],
+                       const uint8_t palette[][4], int count,
+                       uint8_t indices[kTexels]) {
+  uint32_t total = 0;
+  for (int i = 0; i < kTexels; ++i) {
+    int best = INT_MAX;
+    int best_index = 0;
+    for (int entry = 0; entry < count; ++entry) {
+      int distance = 0;
+      for (int c = 0; c < 4; ++c) {
+        int difference = texels[i][c] - palette[entry][c];
+        distance += difference * difference;
+      }
+      if (distance < best) {
+        best = distance;
+        best_index = entry;
+      }
+    }
+    indices[i] = best_index;
+    total += best;
+  }
+  return total;
+}
+#endif
+
+// The mean of the first `channels` channels of the texels and the unit
+// direction along which they vary most, found by power iteration on their
+// covariance. The axis is zero for a block of a single color.
+void PrincipalAxis(const Block &block, int channels, float mean[4],
+                   float axis[4]) {
+  for (int c = 0; c < 4; ++c) {
+    mean[c] = 0.0f;
+    axis[c] = 0.0f;
+  }
+  for (auto &texel : block.texels)
+    for (int c = 0; c < channels; ++c)
+      mean[c] += texel[c];
+  for (int c = 0; c < channels; ++c)
+    mean[c] /= kTexels;
+
+  float covariance[4][4] = {};
+  for (auto &texel : block.texels)
+    for (int a = 0; a < channels; ++a)
+      for (int b = 0; b < channels; ++b)
+        covariance[a][b] += (texel[a] - mean[a]) * (texel[b] - mean[b]);
+
+  // start from the channel that varies most
+  int widest = 0;
+  for (int c = 1; c < channels; ++c)
+    if (covariance[c][c] > covariance[widest][widest])
+      widest = c;
+  if (covariance[widest][widest] <= 0.0f)
+    return;
+  for (int c = 0; c < channels; ++c)
+    axis[c] = covariance[widest][c];
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[4] = {};
+    float largest = 0.0f;
+    for (int a = 0; a < channels; ++a) {
+      for (int b = 0; b < channels; ++b)
+        next[a] += covariance[a][b] * axis[b];
+      largest = std::max(largest, std::abs(next[a]));
+    }
+    if (largest == 0.0f)
+      break;
+    for (int c = 0; c < channels; ++c)
+      axis[c] = next[c] / largest;
+  }
+  float length = 0.0f;
+  for (int c = 0; c < channels; ++c)
+    length += axis[c] * axis[c];
+  length = std::sqrt(length);
+  for (int c = 0; c < channels; ++c)
+    axis[c] /= length;
+}
+
+// Endpoints at the extremes of the texels projected onto their principal
+// axis.
+void AxisEndpoints(const Block &block, int channels, float first[4],
+                   float second[4]) {
+  float mean[4], axis[4];
+  PrincipalAxis(block, channels, mean, axis);
+  float low = 0.0f, high = 0.0f;
+  for (auto &texel : block.texels) {
+    float t = 0.0f;
+    for (int c = 0; c < channels; ++c)
+      t += (texel[c] - mean[c]) * axis[c];
+    low = std::min(low, t);
+    high = std::max(high, t);
+  }
+  for (int c = 0; c < 4; ++c) {
+    first[c] = std::clamp(mean[c] + axis[c] * low, 0.0f, 255.0f);
+    second[c] = std::clamp(mean[c] + axis[c] * high, 0.0f, 255.0f);
+  }
+}
+
+// Least squares fit of the endpoints that best reproduce the texels when
+// each is interpolated at `weights`, 0 at the first endpoint and 1 at the
+// second. Returns false if the weights do not pin both endpoints down.
+bool FitEndpoints(const Block &block, int channels,
+                  const float weights[kTexels], float first[4],
+                  float second[4]) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[4] = {}, bx[4] = {};
+  for (int i = 0; i < kTexels; ++i) {
+    float b = weights[i];
+    float a = 1.0f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < channels; ++c) {
+      ax[c] += a * block.texels[i][c];
+      bx[c] += b * block.texels[i][c];
+    }
+  }
+  float determinant = aa * bb - ab * ab;
+  if (std::abs(determinant) < 1e-6f)
+    return false;
+  for (int c = 0; c < channels; ++c) {
+    first[c] =
+        std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+    second[c] =
+        std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+uint16_t To565(const float color[4]) {
+  int r = std::clamp(int(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+  int g = std::clamp(int(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+  int b = std::clamp(int(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+  return uint16_t(r << 11 | g << 5 | b);
+}
+
+// Expands like decoders do, replicating the high bits; alpha stays 0 so
+// it never counts in SelectIndices.
+void From565(uint16_t color, uint8_t rgba[4]) {
+  int r = color >> 11, g = color >> 5 & 63, b = color & 31;
+  rgba[0] = uint8_t(r << 3 | r >> 2);
+  rgba[1] = uint8_t(g << 2 | g >> 4);
+  rgba[2] = uint8_t(b << 3 | b >> 2);
+  rgba[3] = 0;
+}
+
+// The four color mode of BC1, which is also the color half of BC3.
+void EncodeColors(const Block &block, unsigned char out[8]) {
+  Block colors = block;
+  for (auto &texel : colors.texels)
+    texel[3] = 0;
+
+  float first[4], second[4];
+  AxisEndpoints(colors, 3, first, second);
+  uint16_t best_colors[2] = {0, 0};
+  uint8_t best_indices[kTexels] = {};
+  uint32_t best_error = UINT32_MAX;
+  // one refinement: refit the endpoints to the indices they produced
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    uint16_t endpoints[2] = {To565(first), To565(second)};
+    uint8_t palette[4][4];
+    From565(endpoints[0], palette[0]);
+    From565(endpoints[1], palette[1]);
+    for (int c = 0; c < 4; ++c) {
+      palette[2][c] = uint8_t((2 * palette[0][c] + palette[1][c] + 1) / 3);
+      palette[3][c] = uint8_t((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+    }
+    uint8_t indices[kTexels];
+    uint32_t error = SelectIndices(colors.texels, palette, 4, indices);
+    if (error < best_error) {
+      best_error = error;
+      std::memcpy(best_colors, endpoints, sizeof(endpoints));
+      std::memcpy(best_indices, indices, sizeof(indices));
+    }
+    float weights[kTexels];
+    for (int i = 0; i < kTexels; ++i)
+      weights[i] = kBC1Weights[indices[i]];
+    if (error == 0 || !FitEndpoints(colors, 3, weights, first, second))
+      break;
+  }
+
+  // the first color must be the larger one for four colors; swapping them
+  // swaps indices 0 and 1, and 2 and 3
+  if (best_colors[0] < best_colors[1]) {
+    std::swap(best_colors[0], best_colors[1]);
+    for (uint8_t &index : best_indices)
+      index ^= 1;
+  } else if (best_colors[0] == best_colors[1]) {
+    std::fill(std::begin(best_indices), std::end(best_indices), 0);
+  }
+  uint32_t bits = 0;
+  for (int i = 0; i < kTexels; ++i)
+    bits |= uint32_t(best_indices[i]) << 2 * i;
+  std::memcpy(out, best_colors, 4);
+  std::memcpy(out + 4, &bits, 4);
+}
+
+// The alpha half of BC3: eight values interpolated between the largest
+// and smallest alpha, at 3 bits per texel.
+void EncodeAlpha(const Block &block, unsigned char out[8]) {
+  int high = 0, low = 255;
+  for (auto &texel : block.texels) {
+    high = std::max<int>(high, texel[3]);
+    low = std::min<int>(low, texel[3]);
+  }
+  std::memset(out, 0, 8);
+  out[0] = uint8_t(high);
+  out[1] = uint8_t(low);
+  // with equal endpoints index 0 already is the alpha of every texel
+  if (high == low)
+    return;
+
+  int palette[8] = {high, low};
+  for (int i = 1; i < 7; ++i)
+    palette[i + 1] = ((7 - i) * high + i * low + 3) / 7;
+  uint64_t bits = 0;
+  for (int i = 0; i < kTexels; ++i) {
+    int best_index = 0;
+    for (int entry = 1; entry < 8; ++entry)
+      if (std::abs(block.texels[i][3] - palette[entry]) <
+          std::abs(block.texels[i][3] - palette[best_index]))
+        best_index = entry;
+    bits |= uint64_t(best_index) << 3 * i;
+  }
+  for (int i = 0; i < 6; ++i)
+    out[2 + i] = uint8_t(bits >> 8 * i);
+}
+
+// Picks the 7-bit channels and shared low bit whose 8-bit values,
+// channel << 1 | bit, come closest to `color`.
+void QuantizeEndpoint(const float color[4], uint8_t channels[4], int *bit) {
+  float best = INFINITY;
+  for (int p = 0; p < 2; ++p) {
+    uint8_t quantized[4];
+    float error = 0.0f;
+    for (int c = 0; c < 4; ++c) {
+      quantized[c] = uint8_t(
+          std::clamp(int(std::lround((color[c] - p) / 2.0f)), 0, 127));
+      float difference = (quantized[c] << 1 | p) - color[c];
+      error += difference * difference;
+    }
+    if (error < best) {
+      best = error;
+      std::memcpy(channels, quantized, 4);
+      *bit = p;
+    }
+  }
+}
+
+// BC7 mode 6: one pair of RGBA endpoints with 7-bit channels and a low bit
+// each, and 16 interpolated colors at 4 bits per texel. The other modes
+// split blocks into partitions or rotate channels, which pays off on hard
+// blocks but multiplies the search; mode 6 alone is what fast encoders
+// fall back to.
+void EncodeBC7(const Block &block, unsigned char out[16]) {
+  float first[4], second[4];
+  AxisEndpoints(block, 4, first, second);
+  uint8_t best_channels[2][4] = {};
+  int best_bits[2] = {0, 0};
+  uint8_t best_indices[kTexels] = {};
+  uint32_t best_error = UINT32_MAX;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    uint8_t channels[2][4];
+    int bits[2];
+    QuantizeEndpoint(first, channels[0], &bits[0]);
+    QuantizeEndpoint(second, channels[1], &bits[1]);
+    uint8_t palette[16][4];
+    for (int i = 0; i < 16; ++i)
+      for (int c = 0; c < 4; ++c) {
+        int from = channels[0][c] << 1 | bits[0];
+        int to = channels[1][c] << 1 | bits[1];
+        palette[i][c] = uint8_t(
+            ((64 - kBC7Weights[i]) * from + kBC7Weights[i] * to + 32) >> 6);
+      }
+    uint8_t indices[kTexels];
+    uint32_t error = SelectIndices(block.texels, palette, 16, indices);
+    if (error < best_error) {
+      best_error = error;
+      std::memcpy(best_channels, channels, sizeof(channels));
+      std::memcpy(best_bits, bits, sizeof(bits));
+      std::memcpy(best_indices, indices, sizeof(indices));
+    }
+    float weights[kTexels];
+    for (int i = 0; i < kTexels; ++i)
+      weights[i] = kBC7Weights[indices[i]] / 64.0f;
+    if (error == 0 || !FitEndpoints(block, 4, weights, first, second))
+      break;
+  }
+
+  // the first index is stored without its top bit, which must be 0;
+  // swapping the endpoints mirrors the indices
+  if (best_indices[0] >= 8) {
+    std::swap(best_channels[0], best_channels[1]);
+    std::swap(best_bits[0], best_bits[1]);
+    for (uint8_t &index : best_indices)
+      index = 15 - index;
+  }
+  std::memset(out, 0, 16);
+  BitWriter writer(out);
+  writer.Put(1 << 6, 7);
+  for (int c = 0; c < 4; ++c) {
+    writer.Put(best_channels[0][c], 7);
+    writer.Put(best_channels[1][c], 7);
+  }
+  writer.Put(best_bits[0], 1);
+  writer.Put(best_bits[1], 1);
+  for (int i = 0; i < kTexels; ++i)
+    writer.Put(best_indices[i], i == 0 ? 3 : 4);
+}
+
+// Halves RGBA8 texels with a 2x2 box filter; a 1 texel wide or high image
+// only shrinks along the other side.
+void Downsample(const unsigned char *rgba, int width, int height,
+                unsigned char *out) {
+  int out_width = std::max(1, width / 2);
+  int out_height = std::max(1, height / 2);
+  for (int y = 0; y < out_height; ++y) {
+    const unsigned char *rows[2] = {
+        rgba + size_t(std::min(2 * y, height - 1)) * width * 4,
+        rgba + size_t(std::min(2 * y + 1, height - 1)) * width * 4};
+    for (int x = 0; x < out_width; ++x) {
+      int columns[2] = {std::min(2 * x, width - 1) * 4,
+                        std::min(2 * x + 1, width - 1) * 4};
+      for (int c = 0; c < 4; ++c)
+        out[(size_t(y) * out_width + x) * 4 + c] = uint8_t(
+            (rows[0][columns[0] + c] + rows[0][columns[1] + c] +
+             rows[1][columns[0] + c] + rows[1][columns[1] + c] + 2) >>
+            2);
+    }
+  }
+}
+} // namespace
+
+const char *BlockFormatName(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::kBC1:
+    return "BC1";
+  case BlockFormat::kBC3:
+    return "BC3";
+  case BlockFormat::kBC7:
+    return "BC7";
+  }
+  return "";
+}
+
+size_t BlockBytes(BlockFormat format) {
+  return format == BlockFormat::kBC1 ? 8 : 16;
+}
+
+int BlockChannels(BlockFormat format) {
+  return format == BlockFormat::kBC1 ? 3 : 4;
+}
+
+int MipLevelCount(int width, int height) {
+  int levels = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2)
+    ++levels;
+  return levels;
+}
+
+size_t LevelSize(BlockFormat format, int width, int height, int level) {
+  size_t columns = (std::max(1, width >> level) + kBlockSize - 1) / kBlockSize;
+  size_t rows = (std::max(1, height >> level) + kBlockSize - 1) / kBlockSize;
+  return columns * rows * BlockBytes(format);
+}
+
+void CompressLevel(BlockFormat format, const unsigned char *rgba, int width,
+                   int height, unsigned char *blocks) {
+  int columns = (width + kBlockSize - 1) / kBlockSize;
+  int rows = (height + kBlockSize - 1) / kBlockSize;
+  Block block;
+  for (int row = 0; row < rows; ++row) {
+    for (int column = 0; column < columns; ++column) {
+      LoadBlock(rgba, width, height, column, row, &block);
+      unsigned char *out =
+          blocks + (size_t(row) * columns + column) * BlockBytes(format);
+      switch (format) {
+      case BlockFormat::kBC1:
+        EncodeColors(block, out);
+        break;
+      case BlockFormat::kBC3:
+        EncodeAlpha(block, out);
+        EncodeColors(block, out + 8);
+        break;
+      case BlockFormat::kBC7:
+        EncodeBC7(block, out);
+        break;
+      }
+    }
+  }
+}
+
+CompressedImage CompressMipChain(BlockFormat format, const unsigned char *rgba,
+                                 int width, int height) {
+  CompressedImage image;
+  image.format = format;
+  image.width = width;
+  image.height = height;
+  int levels = MipLevelCount(width, height);
+  size_t size = 0;
+  for (int level = 0; level < levels; ++level)
+    size += LevelSize(format, width, height, level);
+  image.data.resize(size);
+
+  std::vector<unsigned char> texels(rgba, rgba + size_t(width) * height * 4);
+  std::vector<unsigned char> smaller;
+  size_t offset = 0;
+  for (int level = 0; level < levels; ++level) {
+    int level_width = std::max(1, width >> level);
+    int level_height = std::max(1, height >> level);
+    CompressLevel(format, texels.data(), level_width, level_height,
+                  image.data.data() + offset);
+    offset += LevelSize(format, width, height, level);
+    if (level + 1 == levels)
+      break;
+    smaller.resize(size_t(std::max(1, level_width / 2)) *
+                   std::max(1, level_height / 2) * 4);
+    Downsample(texels.data(), level_width, level_height, smaller.data());
+    texels.swap(smaller);
+  }
+  return image;
+}
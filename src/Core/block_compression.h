@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Block compressed texture formats the CPU encoder below can produce. Each
+// encodes a 4x4 texel block into a fixed number of bytes:
+//
+//   BC1  8 bytes, RGB at 4 bits per texel, opaque
+//   BC3  16 bytes, BC1 colors plus an interpolated alpha channel
+//   BC7  16 bytes, RGBA at the best quality of the three
+//
+// against 48 or 64 bytes for the block as RGB8 or RGBA8.
+enum class BlockFormat { kBC1, kBC3, kBC7 };
+
+constexpr int kBlockSize = 4;
+
+// "BC1", "BC3" or "BC7".
+const char *BlockFormatName(BlockFormat format);
+size_t BlockBytes(BlockFormat format);
+// The channels a texel decodes to: 3 for BC1, 4 for the others.
+int BlockChannels(BlockFormat format);
+
+// The number of mip levels of a full chain, down to 1x1.
+int MipLevelCount(int width, int height);
+// The size in bytes of mip level `level` of a `width` x `height` image.
+size_t LevelSize(BlockFormat format, int width, int height, int level);
+
+// A block compressed image with its full mip chain.
+struct CompressedImage {
+  BlockFormat format = BlockFormat::kBC1;
+  int width = 0;
+  int height = 0;
+  // every mip level, level 0 first, back to back; blocks are stored row by
+  // row, and each mip level from MipLevelCount is present
+  std::vector<unsigned char> data;
+};
+
+// Encodes `width` x `height` RGBA8 texels into blocks of `format`, row by
+// row, writing LevelSize(format, width, height, 0) bytes to `blocks`.
+// Blocks reaching past the right or bottom edge repeat the edge texels.
+void CompressLevel(BlockFormat format, const unsigned char *rgba, int width,
+                   int height, unsigned char *blocks);
+
+// Builds the mip chain of `width` x `height` RGBA8 texels with a box filter,
+// the same one glGenerateMipmap uses on most drivers, and encodes every
+// level into `format`.
+CompressedImage CompressMipChain(BlockFormat format, const unsigned char *rgba,
+                                 int width, int height);
@@ -0,0 +1,513 @@
+#include "context.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef GLTEST_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+// simulated frame time of headless runs
+const double kHeadlessFrameTime = 1.0 / 60.0;
+// the frame limiter spins instead of sleeping for this long before a frame
+const auto kSpinTime = std::chrono::milliseconds(2);
+// frames drawn on demand after each event
+const int kSettleFrames = 2;
+
+void HandleGLFWError(int error, const char *description) {
+  spdlog::error("GLFW Error: {}", description);
+}
+
+// User and system CPU time of the whole process, in seconds.
+double ProcessCpuTime() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0.0;
+  auto seconds = [](FILETIME time) {
+    return (uint64_t(time.dwHighDateTime) << 32 | time.dwLowDateTime) * 1e-7;
+  };
+  return seconds(kernel) + seconds(user);
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+double Seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+// Matches `--name=value` or `--name`, returning the value or "" in `value`.
+bool MatchOption(const char *argument, const char *name,
+                 const char *&value) {
+  size_t length = std::strlen(name);
+  if (std::strncmp(argument, name, length) != 0)
+    return false;
+  if (argument[length] == '=')
+    value = argument + length + 1;
+  else if (argument[length] == '\0')
+    value = "";
+  else
+    return false;
+  return true;
+}
+} // namespace
+
+bool ParseContextOptions(int &argc, char **argv, ContextOptions &options) {
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    const char *value = nullptr;
+    if (MatchOption(argv[i], "--headless", value) && !*value) {
+      options.headless = true;
+    } else if (MatchOption(argv[i], "--size", value)) {
+      int width = 0, height = 0;
+      if (std::sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 ||
+          height <= 0) {
+        spdlog::error("expected --size=WIDTHxHEIGHT, got {}", argv[i]);
+        return false;
+      }
+      options.width = width;
+      options.height = height;
+    } else if (MatchOption(argv[i], "--frames", value)) {
+      int frames = 0;
+      if (std::sscanf(value, "%d", &frames) != 1 || frames <= 0) {
+        spdlog::error("expected --frames=N, got {}", argv[i]);
+        return false;
+      }
+      options.frames = frames;
+    } else if (MatchOption(argv[i], "--profile", value) && *value) {
+      options.profile = value;
+    } else if (MatchOption(argv[i], "--pacing", value)) {
+      if (std::strcmp(value, "vsync") == 0) {
+        options.pacing = FramePacing::kVsync;
+      } else if (std::strcmp(value, "uncapped") == 0) {
+        options.pacing = FramePacing::kUncapped;
+      } else if (std::strcmp(value, "limit") == 0) {
+        options.pacing = FramePacing::kLimit;
+      } else {
+        spdlog::error("expected --pacing=vsync|uncapped|limit, got {}",
+                      argv[i]);
+        return false;
+      }
+    } else if (MatchOption(argv[i], "--fps", value)) {
+      double fps = 0.0;
+      if (std::sscanf(value, "%lf", &fps) != 1 || fps <= 0.0) {
+        spdlog::error("expected --fps=N, got {}", argv[i]);
+        return false;
+      }
+      options.fps = fps;
+      options.pacing = FramePacing::kLimit;
+    } else if (MatchOption(argv[i], "--on-demand", value) && !*value) {
+      options.on_demand = true;
+    } else if (MatchOption(argv[i], "--debug", value) && !*value) {
+      options.debug = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+  return true;
+}
+
+std::unique_ptr<Context> Context::Create(const ContextOptions &options,
+                                         const char *title, int major,
+                                         int minor) {
+  std::unique_ptr<Context> context(new Context);
+  context->headless_ = options.headless;
+  context->width_ = options.width;
+  context->height_ = options.height;
+  context->frames_ = options.frames;
+  context->profile_path_ = options.profile;
+  context->pacing_ = options.pacing;
+  context->frame_period_ = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / options.fps));
+  // headless frames have no events to wait for
+  context->on_demand_ = options.on_demand && !options.headless;
+  context->settle_frames_ = kSettleFrames;
+  context->start_time_ = Clock::now();
+  context->start_cpu_time_ = ProcessCpuTime();
+
+  bool created = false;
+  if (options.headless) {
+    created = context->CreateSurfaceless(major, minor, options.debug);
+    if (!created) {
+      spdlog::info("no surfaceless EGL context, using a hidden window");
+      created = context->OpenWindow(options, title, major, minor, false);
+    }
+  } else {
+    created = context->OpenWindow(options, title, major, minor, true);
+  }
+  if (!created)
+    return nullptr;
+
+  // get version info
+  spdlog::info("Renderer: {}", glGetString(GL_RENDERER));
+  spdlog::info("OpenGL version supported: {}", glGetString(GL_VERSION));
+
+  if (options.debug) {
+    GLint flags = 0;
+    glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+    if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT))
+      spdlog::warn("asked for a debug context but did not get one");
+    // first, so the other objects of the context are labelled for it
+    if (GLAD_GL_VERSION_4_3 || GLAD_GL_KHR_debug)
+      context->debug_ = std::make_unique<DebugOutput>();
+    else
+      spdlog::warn("KHR_debug unavailable, not logging GL messages");
+  }
+  context->profiler_ = std::make_unique<FrameProfiler>();
+  context->state_ = std::make_unique<RenderState>();
+
+  if (options.headless) {
+    context->CreateFramebuffer();
+    spdlog::info("rendering {} frames offscreen at {}x{}", options.frames,
+                 options.width, options.height);
+  }
+  if (options.pacing == FramePacing::kLimit)
+    spdlog::info("limiting frames to {} per second", options.fps);
+  else if (options.pacing == FramePacing::kUncapped || options.headless)
+    spdlog::info("presenting frames uncapped");
+  if (context->on_demand_)
+    spdlog::info("drawing frames on demand");
+  return context;
+}
+
+bool Context::OpenWindow(const ContextOptions &options, const char *title,
+                         int major, int minor, bool visible) {
+  glfwSetErrorCallback(HandleGLFWError);
+
+  // start GL context and O/S window using the GLFW helper library
+  if (!glfwInit()) {
+    spdlog::error("could not start GLFW3");
+    return false;
+  }
+  glfw_ = true;
+
+  // Anti-Aliasing
+  glfwWindowHint(GLFW_SAMPLES, 4);
+
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT,
+                 options.debug ? GLFW_TRUE : GLFW_FALSE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+
+  window_ =
+      glfwCreateWindow(options.width, options.height, title, NULL, NULL);
+  if (!window_) {
+    spdlog::error("could not open window with GLFW3");
+    return false;
+  }
+  glfwMakeContextCurrent(window_);
+  // headless frames are paced by fences rather than the display
+  glfwSwapInterval(visible && options.pacing == FramePacing::kVsync ? 1 : 0);
+  glfwSetWindowUserPointer(window_, this);
+  glfwSetKeyCallback(window_, HandleKey);
+
+  if (!gladLoadGL()) {
+    spdlog::error("failed to initialize OpenGL loader");
+    return false;
+  }
+  return true;
+}
+
+bool Context::CreateSurfaceless(int major, int minor, bool debug) {
+#ifdef GLTEST_HAVE_EGL
+  EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+  // needs no display server at all
+  auto get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+          eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (get_platform_display)
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                   EGL_DEFAULT_DISPLAY, nullptr);
+#endif
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  EGLint egl_major = 0, egl_minor = 0;
+  if (display == EGL_NO_DISPLAY ||
+      !eglInitialize(display, &egl_major, &egl_minor))
+    return false;
+  egl_display_ = display;
+
+  const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (!extensions ||
+      !std::strstr(extensions, "EGL_KHR_surfaceless_context") ||
+      !eglBindAPI(EGL_OPENGL_API))
+    return false;
+
+  EGLint config_attributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                EGL_NONE};
+  EGLConfig config = nullptr;
+  EGLint config_count = 0;
+  eglChooseConfig(display, config_attributes, &config, 1, &config_count);
+
+  EGLint context_attributes[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                 major,
+                                 EGL_CONTEXT_MINOR_VERSION,
+                                 minor,
+                                 EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                 EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                 EGL_CONTEXT_FLAGS_KHR,
+                                 debug ? EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR : 0,
+                                 EGL_NONE};
+  EGLContext context = eglCreateContext(
+      display, config_count > 0 ? config : nullptr, EGL_NO_CONTEXT,
+      context_attributes);
+  if (context == EGL_NO_CONTEXT)
+    return false;
+  egl_context_ = context;
+  if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    return false;
+
+  if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress))) {
+    spdlog::error("failed to initialize OpenGL loader");
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Context::CreateFramebuffer() {
+  glGenRenderbuffers(1, &color_buffer_);
+  glBindRenderbuffer(GL_RENDERBUFFER, color_buffer_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_);
+  glGenRenderbuffers(1, &depth_buffer_);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width_, height_);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer_);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color_buffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depth_buffer_);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    spdlog::error("offscreen framebuffer is incomplete");
+  glViewport(0, 0, width_, height_);
+}
+
+Context::~Context() {
+  if (profiler_) {
+    profiler_->Finish();
+    profiler_->Report(profile_path_);
+    profiler_.reset();
+  }
+  if (state_ && state_->frames() > 0) {
+    const RenderState::Counts &total = state_->total();
+    uint64_t calls = total.issued + total.skipped;
+    spdlog::info("render state: {:.1f} calls/frame issued, {:.1f} skipped "
+                 "({:.0f}% of {:.1f})",
+                 double(total.issued) / state_->frames(),
+                 double(total.skipped) / state_->frames(),
+                 calls ? 100.0 * total.skipped / calls : 0.0,
+                 double(calls) / state_->frames());
+  }
+
+  if (window_ && !headless_) {
+    double time = Seconds(Clock::now() - start_time_);
+    double cpu_time = ProcessCpuTime() - start_cpu_time_;
+    spdlog::info("{} frames and {} wakeups in {:.1f} s ({:.1f} wakeups/s), "
+                 "{:.1f}% CPU",
+                 frame_count_, wakeups_, time, wakeups_ / time,
+                 100.0 * cpu_time / time);
+    double busy_time = time - idle_time_;
+    if (on_demand_ && idle_time_ > 0.0 && busy_time > 0.0)
+      spdlog::info("idle {:.0f}% of the time at {:.1f}% CPU, busy at {:.1f}% "
+                   "CPU",
+                   100.0 * idle_time_ / time,
+                   100.0 * idle_cpu_time_ / idle_time_,
+                   100.0 * (cpu_time - idle_cpu_time_) / busy_time);
+  }
+
+  if (framebuffer_) {
+    for (GLsync fence : frame_fences_)
+      if (fence)
+        glDeleteSync(fence);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer_);
+    glDeleteRenderbuffers(1, &color_buffer_);
+    glDeleteRenderbuffers(1, &depth_buffer_);
+  }
+
+  if (debug_) {
+    debug_->Report();
+    debug_.reset();
+  }
+
+#ifdef GLTEST_HAVE_EGL
+  if (egl_display_) {
+    eglMakeCurrent(egl_display_, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    if (egl_context_)
+      eglDestroyContext(egl_display_, egl_context_);
+    eglTerminate(egl_display_);
+  }
+#endif
+
+  // close GL context and any other GLFW resources
+  if (glfw_)
+    glfwTerminate();
+}
+
+int Context::width() const {
+  if (headless_)
+    return width_;
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window_, &width, &height);
+  return width;
+}
+
+int Context::height() const {
+  if (headless_)
+    return height_;
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window_, &width, &height);
+  return height;
+}
+
+double Context::Time() const {
+  if (headless_)
+    return frame_count_ * kHeadlessFrameTime;
+  return glfwGetTime();
+}
+
+bool Context::ShouldClose() const {
+  if (headless_)
+    return frame_count_ >= frames_;
+  return glfwWindowShouldClose(window_);
+}
+
+void Context::HandleKey(GLFWwindow *window, int key, int scancode,
+                        int action, int mods) {
+  auto context = static_cast<Context *>(glfwGetWindowUserPointer(window));
+  if (action != GLFW_RELEASE && !context->input_pending_) {
+    context->input_pending_ = true;
+    context->input_time_ = Clock::now();
+  }
+  if (context->key_callback_)
+    context->key_callback_(window, key, scancode, action, mods);
+}
+
+void Context::Pace() {
+  auto now = Clock::now();
+  next_frame_ += frame_period_;
+  // a late frame starts a new schedule rather than rushing the next ones
+  if (next_frame_ < now)
+    next_frame_ = now;
+  if (next_frame_ - now > kSpinTime)
+    std::this_thread::sleep_until(next_frame_ - kSpinTime);
+  while (Clock::now() < next_frame_)
+    std::this_thread::yield();
+}
+
+void Context::RequestRedraw(double seconds) {
+  auto time = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double>(seconds));
+  redraw_time_ = std::min(redraw_time_, time);
+}
+
+void Context::WaitForRedraw() {
+  if (settle_frames_ > 0) {
+    --settle_frames_;
+    glfwPollEvents();
+    ++wakeups_;
+    return;
+  }
+
+  auto start = Clock::now();
+  double start_cpu_time = ProcessCpuTime();
+  if (redraw_time_ == Clock::time_point::max())
+    glfwWaitEvents();
+  else if (redraw_time_ > start)
+    glfwWaitEventsTimeout(Seconds(redraw_time_ - start));
+  else
+    glfwPollEvents();
+  ++wakeups_;
+
+  auto now = Clock::now();
+  // returning before the redraw was due means events arrived
+  if (now < redraw_time_)
+    settle_frames_ = kSettleFrames;
+  redraw_time_ = Clock::time_point::max();
+  idle_time_ += Seconds(now - start);
+  idle_cpu_time_ += ProcessCpuTime() - start_cpu_time;
+}
+
+void Context::EndFrame() {
+  ++frame_count_;
+  profiler_->Begin("present");
+
+  if (headless_) {
+    // keep at most two frames queued, like a double-buffered swap chain
+    GLsync &fence = frame_fences_[frame_count_ % 2];
+    if (fence) {
+      glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+      glDeleteSync(fence);
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    if (pacing_ == FramePacing::kLimit) {
+      profiler_->Begin("pace");
+      Pace();
+    }
+    profiler_->EndFrame();
+    state_->EndFrame();
+    if (window_)
+      glfwPollEvents();
+    return;
+  }
+
+  // put the stuff we've been drawing onto the display
+  glfwSwapBuffers(window_);
+  // events are only delivered by the poll below, so this frame is the
+  // first to have seen any pending one
+  if (input_pending_) {
+    profiler_->SetInputLatency(
+        std::chrono::duration<float, std::milli>(Clock::now() - input_time_)
+            .count());
+    input_pending_ = false;
+  }
+  if (pacing_ == FramePacing::kLimit) {
+    profiler_->Begin("pace");
+    Pace();
+  }
+  profiler_->EndFrame();
+  state_->EndFrame();
+  // update other events like input handling
+  if (on_demand_) {
+    WaitForRedraw();
+  } else {
+    glfwPollEvents();
+    ++wakeups_;
+  }
+
+  if (GLFW_PRESS == glfwGetKey(window_, GLFW_KEY_ESCAPE)) {
+    glfwSetWindowShouldClose(window_, 1);
+  }
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <glad/glad.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "debug_output.h"
+#include "frame_profiler.h"
+#include "render_state.h"
+
+// How finished frames reach the screen.
+enum class FramePacing {
+  // wait for the display's vertical blank
+  kVsync,
+  // present as fast as frames are made, for benchmarking
+  kUncapped,
+  // present without vsync, but at most `ContextOptions::fps` times a second
+  kLimit,
+};
+
+// Command line options shared by every demo. The demo fills in its default
+// size before parsing.
+struct ContextOptions {
+  int width = 600;
+  int height = 400;
+  // render offscreen without a window, then exit after `frames` frames
+  bool headless = false;
+  int frames = 300;
+  // where to write per-frame timings at exit; empty logs only a summary
+  std::string profile;
+  // headless runs have no display to sync to and treat vsync as uncapped
+  FramePacing pacing = FramePacing::kVsync;
+  double fps = 60.0;
+  // draw only when something changed; see Context::RequestRedraw
+  bool on_demand = false;
+  // create a debug context and log its messages; see DebugOutput
+  bool debug = false;
+};
+
+// Removes the options it understands from argv and leaves the rest for the
+// demo:
+//   --headless           render offscreen instead of opening a window
+//   --size=WIDTHxHEIGHT  framebuffer size
+//   --frames=N           frames to render before exiting when headless
+//   --profile=FILE       write per-frame timings to FILE, as JSON if it ends
+//                        in .json and as CSV otherwise
+//   --pacing=MODE        vsync (the default), uncapped or limit
+//   --fps=N              frame rate of --pacing=limit, which it implies
+//   --on-demand          redraw only after events or requested redraws
+//   --debug              use a debug context and log its messages
+// Returns false after logging the reason if an option is malformed.
+bool ParseContextOptions(int &argc, char **argv, ContextOptions &options);
+
+// The GL context a demo renders with, and its frame loop.
+//
+// Normally this is a GLFW window, presenting with vsync unless the options
+// say otherwise. A frame limit sleeps after the present until shortly
+// before the next frame is due and spins the rest of the way, since sleeps
+// overshoot by up to a scheduler tick; waiting before polling input rather
+// than after rendering keeps input latency low. Headless, it is an EGL
+// surfaceless context when EGL is available, or an invisible GLFW window
+// otherwise, with an offscreen framebuffer of the requested size bound for
+// the whole run. Demos draw to framebuffer 0's binding point as usual and
+// never notice the difference. Swapping then only keeps at most two frames
+// in flight, as a swap chain would, and time advances a fixed 1/60 s per
+// frame so headless runs are reproducible.
+//
+// Windowed, the context counts how often the loop wakes up to process
+// events and how much CPU time the process used, and logs both when it is
+// destroyed; with --on-demand it splits them into the time spent idle,
+// waiting for events, and busy drawing.
+class Context {
+public:
+  // Creates the context, makes it current, loads GL and logs the renderer.
+  // Returns null after logging the reason on failure.
+  static std::unique_ptr<Context> Create(const ContextOptions &options,
+                                         const char *title, int major = 4,
+                                         int minor = 2);
+  ~Context();
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  // The demo window, or null when headless. Input callbacks are only
+  // installed when there is one.
+  GLFWwindow *window() const { return window_; }
+  bool headless() const { return headless_; }
+
+  int width() const;
+  int height() const;
+
+  // Seconds since the context was created.
+  double Time() const;
+
+  // True once the window was closed or Escape pressed, or once the headless
+  // frame budget is used up.
+  bool ShouldClose() const;
+
+  // Presents the frame, timed as the "present" phase, waits for the frame
+  // limit, timed as "pace", ends the profiler's and the render state's frame
+  // and processes window events. On demand, it then blocks until there is a
+  // reason to draw again: an event, such as input or a resize, or a redraw
+  // that is due. A couple of frames follow every event, so code that
+  // reacts to input a frame late, like imgui, settles.
+  void EndFrame();
+
+  // Asks for the next frame to be drawn at most `seconds` from now when
+  // drawing on demand; animations ask every frame and changed resources
+  // once. Only the earliest request counts, and each is used up by the
+  // frame it causes.
+  void RequestRedraw(double seconds = 0.0);
+  bool on_demand() const { return on_demand_; }
+
+  // Key events reach `callback` through the context, which times them
+  // until the first present after them and reports that latency with the
+  // frame times. Use this rather than glfwSetKeyCallback.
+  void SetKeyCallback(GLFWkeyfun callback) { key_callback_ = callback; }
+
+  // Times the phases of every frame; its summary, and the frames themselves
+  // with --profile, are written when the context is destroyed.
+  FrameProfiler &profiler() { return *profiler_; }
+
+  // Null unless the options asked for a debug context and it has KHR_debug.
+  DebugOutput *debug() { return debug_.get(); }
+
+  // Skips redundant state changes of the frame loop; how many it issued and
+  // skipped per frame is logged when the context is destroyed.
+  RenderState &state() { return *state_; }
+
+  int frame_count() const { return frame_count_; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  Context() = default;
+
+  static void HandleKey(GLFWwindow *window, int key, int scancode,
+                        int action, int mods);
+
+  bool OpenWindow(const ContextOptions &options, const char *title,
+                  int major, int minor, bool visible);
+  bool CreateSurfaceless(int major, int minor, bool debug);
+  void CreateFramebuffer();
+  // Waits until the next frame is due.
+  void Pace();
+  // Blocks in glfwWaitEvents until an event or a requested redraw.
+  void WaitForRedraw();
+
+  GLFWwindow *window_ = nullptr;
+  bool glfw_ = false;
+  bool headless_ = false;
+  int width_ = 0;
+  int height_ = 0;
+  int frames_ = 0;
+  int frame_count_ = 0;
+
+  FramePacing pacing_ = FramePacing::kVsync;
+  Clock::duration frame_period_{};
+  Clock::time_point next_frame_;
+
+  GLFWkeyfun key_callback_ = nullptr;
+  // the first key event no present has shown yet
+  bool input_pending_ = false;
+  Clock::time_point input_time_;
+
+  bool on_demand_ = false;
+  Clock::time_point redraw_time_ = Clock::time_point::max();
+  // frames still to draw after the last event
+  int settle_frames_ = 0;
+
+  // returns from polling or waiting for events
+  uint64_t wakeups_ = 0;
+  Clock::time_point start_time_;
+  double start_cpu_time_ = 0.0;
+  // spent blocked in WaitForRedraw
+  double idle_time_ = 0.0;
+  double idle_cpu_time_ = 0.0;
+
+  std::unique_ptr<DebugOutput> debug_;
+  std::unique_ptr<FrameProfiler> profiler_;
+  std::unique_ptr<RenderState> state_;
+  std::string profile_path_;
+
+  // EGLDisplay and EGLContext, kept opaque so users need no EGL headers
+  void *egl_display_ = nullptr;
+  void *egl_context_ = nullptr;
+
+  GLuint framebuffer_ = 0;
+  GLuint color_buffer_ = 0;
+  GLuint depth_buffer_ = 0;
+  GLsync frame_fences_[2] = {};
+};
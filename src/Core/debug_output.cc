@@ -0,0 +1,165 @@
+#include "debug_output.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+DebugOutput *active_output = nullptr;
+
+uint64_t LabelKey(GLenum identifier, GLuint name) {
+  return uint64_t(identifier) << 32 | name;
+}
+
+const char *SourceName(GLenum source) {
+  switch (source) {
+  case GL_DEBUG_SOURCE_API:
+    return "API";
+  case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+    return "window system";
+  case GL_DEBUG_SOURCE_SHADER_COMPILER:
+    return "shader compiler";
+  case GL_DEBUG_SOURCE_THIRD_PARTY:
+    return "third party";
+  case GL_DEBUG_SOURCE_APPLICATION:
+    return "application";
+  default:
+    return "other";
+  }
+}
+
+const char *TypeName(GLenum type) {
+  switch (type) {
+  case GL_DEBUG_TYPE_ERROR:
+    return "error";
+  case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+    return "deprecated behavior";
+  case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+    return "undefined behavior";
+  case GL_DEBUG_TYPE_PORTABILITY:
+    return "portability";
+  case GL_DEBUG_TYPE_PERFORMANCE:
+    return "performance";
+  case GL_DEBUG_TYPE_MARKER:
+    return "marker";
+  default:
+    return "other";
+  }
+}
+
+spdlog::level::level_enum SeverityLevel(GLenum severity) {
+  switch (severity) {
+  case GL_DEBUG_SEVERITY_HIGH:
+    return spdlog::level::err;
+  case GL_DEBUG_SEVERITY_MEDIUM:
+    return spdlog::level::warn;
+  case GL_DEBUG_SEVERITY_LOW:
+    return spdlog::level::info;
+  default:
+    return spdlog::level::debug;
+  }
+}
+} // namespace
+
+void LabelObject(GLenum identifier, GLuint name, const std::string &label) {
+  if (!GLAD_GL_VERSION_4_3 && !GLAD_GL_KHR_debug)
+    return;
+  glObjectLabel(identifier, name, label.size(), label.data());
+  if (active_output)
+    active_output->labels_[LabelKey(identifier, name)] = label;
+}
+
+DebugOutput::DebugOutput() {
+  active_output = this;
+  glEnable(GL_DEBUG_OUTPUT);
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr,
+                        GL_TRUE);
+  glDebugMessageCallback(HandleMessage, this);
+}
+
+DebugOutput::~DebugOutput() {
+  glDebugMessageCallback(nullptr, nullptr);
+  glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  glDisable(GL_DEBUG_OUTPUT);
+  active_output = nullptr;
+}
+
+void APIENTRY DebugOutput::HandleMessage(GLenum source, GLenum type,
+                                         GLuint id, GLenum severity,
+                                         GLsizei length,
+                                         const GLchar *message,
+                                         const void *user) {
+  // some drivers pass a negative length for null-terminated messages
+  std::string text = length < 0 ? std::string(message)
+                                : std::string(message, length);
+  while (!text.empty() && std::isspace((unsigned char)text.back()))
+    text.pop_back();
+  auto output = static_cast<DebugOutput *>(const_cast<void *>(user));
+  output->Handle(source, type, id, severity, text);
+}
+
+void DebugOutput::Handle(GLenum source, GLenum type, GLuint id,
+                         GLenum severity, const std::string &message) {
+  ++messages_;
+  if (type == GL_DEBUG_TYPE_PERFORMANCE) {
+    ++performance_messages_;
+    Counter &counter = counters_[{id, ObjectIn(message)}];
+    if (counter.count++ > 0)
+      return;
+    counter.message = message;
+  }
+  spdlog::log(SeverityLevel(severity), "GL {} {} {}: {}", SourceName(source),
+              TypeName(type), id, message);
+}
+
+std::string DebugOutput::ObjectIn(const std::string &message) const {
+  // drivers name objects like "buffer object 3", "Buffer 3" or "program 7"
+  const std::pair<const char *, GLenum> kKinds[] = {
+      {"buffer", GL_BUFFER}, {"texture", GL_TEXTURE}, {"program", GL_PROGRAM}};
+  std::string text = message;
+  for (char &c : text)
+    c = std::tolower((unsigned char)c);
+  for (size_t at = 0; at < text.size(); ++at) {
+    for (auto &[kind, identifier] : kKinds) {
+      size_t length = std::strlen(kind);
+      if (text.compare(at, length, kind) != 0 ||
+          (at > 0 && std::isalpha((unsigned char)text[at - 1])))
+        continue;
+      size_t number = at + length;
+      if (text.compare(number, 7, " object") == 0)
+        number += 7;
+      if (number + 1 >= text.size() || text[number] != ' ' ||
+          !std::isdigit((unsigned char)text[number + 1]))
+        continue;
+      auto name = GLuint(std::strtoul(text.c_str() + number + 1, nullptr, 10));
+      auto label = labels_.find(LabelKey(identifier, name));
+      if (label != labels_.end())
+        return label->second;
+      return std::string(kind) + " " + std::to_string(name);
+    }
+  }
+  return "";
+}
+
+void DebugOutput::Report() const {
+  if (performance_messages_ == 0)
+    return;
+  std::vector<std::pair<std::pair<GLuint, std::string>, Counter>> counters(
+      counters_.begin(), counters_.end());
+  std::stable_sort(counters.begin(), counters.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second.count > b.second.count;
+                   });
+  spdlog::info("{} GL performance messages, {} kinds:", performance_messages_,
+               counters.size());
+  spdlog::info("{:>9} {:>10}  {:<24} {}", "count", "id", "object",
+               "first message");
+  for (auto &[key, counter] : counters)
+    spdlog::info("{:>9} {:>10}  {:<24} {}", counter.count, key.first,
+                 key.second.empty() ? "-" : key.second, counter.message);
+}
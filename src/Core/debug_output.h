@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Names a GL object, such as a GL_BUFFER, GL_TEXTURE or GL_PROGRAM, for
+// debug messages and for tools like RenderDoc, and lets the active
+// DebugOutput attribute messages about it to `label`. Does nothing without
+// KHR_debug. The object must exist, so a name from glGen* must have been
+// bound once.
+void LabelObject(GLenum identifier, GLuint name, const std::string &label);
+
+// Receives the messages of a debug context through glDebugMessageCallback.
+// Errors, warnings and other messages are written to spdlog at the level
+// their severity maps to:
+//
+//   HIGH -> error, MEDIUM -> warn, LOW -> info, NOTIFICATION -> debug
+//
+// Performance messages, such as implicit syncs, shader recompiles or
+// redundant state, tend to repeat every frame, so they are counted instead,
+// per message ID and object, and only the first of each is logged. The
+// object is the label of the buffer, texture or program the message names,
+// as given to LabelObject, or "" if it names none. Report logs the counts.
+//
+// Output is synchronous, so messages arrive on the thread making the GL
+// call that caused them, while it is still in that call; a debugger
+// breakpoint in the callback shows the call site.
+class DebugOutput {
+public:
+  // Must be created and destroyed with the GL context current, and only
+  // when the context has KHR_debug. There is one at a time.
+  DebugOutput();
+  ~DebugOutput();
+
+  DebugOutput(const DebugOutput &) = delete;
+  DebugOutput &operator=(const DebugOutput &) = delete;
+
+  // Logs the performance message counts, most frequent first.
+  void Report() const;
+
+  uint64_t messages() const { return messages_; }
+  uint64_t performance_messages() const { return performance_messages_; }
+
+private:
+  struct Counter {
+    uint64_t count = 0;
+    // the text of the first message, which was logged
+    std::string message;
+  };
+
+  static void APIENTRY HandleMessage(GLenum source, GLenum type, GLuint id,
+                                     GLenum severity, GLsizei length,
+                                     const GLchar *message,
+                                     const void *user);
+  void Handle(GLenum source, GLenum type, GLuint id, GLenum severity,
+              const std::string &message);
+  // The label of the first object `message` names, if any.
+  std::string ObjectIn(const std::string &message) const;
+
+  friend void LabelObject(GLenum identifier, GLuint name,
+                          const std::string &label);
+
+  // labels by identifier << 32 | name
+  std::unordered_map<uint64_t, std::string> labels_;
+  // performance messages by ID and object
+  std::map<std::pair<GLuint, std::string>, Counter> counters_;
+  uint64_t messages_ = 0;
+  uint64_t performance_messages_ = 0;
+};
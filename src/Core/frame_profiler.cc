@@ -0,0 +1,340 @@
+#include "frame_profiler.h"
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+namespace {
+double Milliseconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Mean, median, 95th and 99th percentile of the non-negative `values`.
+struct Summary {
+  size_t count = 0;
+  double mean = 0.0;
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+};
+
+Summary Summarize(std::vector<float> values) {
+  values.erase(std::remove_if(values.begin(), values.end(),
+                              [](float value) { return value < 0.0f; }),
+               values.end());
+  Summary summary;
+  summary.count = values.size();
+  if (values.empty())
+    return summary;
+  std::sort(values.begin(), values.end());
+  double sum = 0.0;
+  for (float value : values)
+    sum += value;
+  summary.mean = sum / values.size();
+  // nearest rank
+  auto percentile = [&](double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values[std::max<size_t>(rank, 1) - 1];
+  };
+  summary.p50 = percentile(0.50);
+  summary.p95 = percentile(0.95);
+  summary.p99 = percentile(0.99);
+  return summary;
+}
+
+std::string CsvField(float value) {
+  return value < 0.0f ? std::string() : fmt::format("{:.4f}", value);
+}
+
+std::string JsonNumber(float value) {
+  return value < 0.0f ? std::string("null") : fmt::format("{:.4f}", value);
+}
+
+std::string JsonString(const std::string &value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+// A logger that writes each message verbatim to `path`, or null after
+// logging why the file could not be opened.
+std::shared_ptr<spdlog::logger> OpenExport(const std::string &path) {
+  try {
+    auto logger = std::make_shared<spdlog::logger>(
+        "frame_profile",
+        std::make_shared<spdlog::sinks::basic_file_sink_st>(path, true));
+    logger->set_pattern("%v");
+    return logger;
+  } catch (const spdlog::spdlog_ex &error) {
+    spdlog::error("could not write frame profile {}: {}", path, error.what());
+    return nullptr;
+  }
+}
+} // namespace
+
+void FrameRing::Push(const FrameRecord &record) {
+  uint64_t count = count_.load(std::memory_order_relaxed);
+  records_[count % records_.size()] = record;
+  count_.store(count + 1, std::memory_order_release);
+}
+
+void FrameRing::Snapshot(std::vector<FrameRecord> *records) const {
+  uint64_t end = count_.load(std::memory_order_acquire);
+  uint64_t begin = end > records_.size() ? end - records_.size() : 0;
+  records->clear();
+  for (uint64_t i = begin; i < end; ++i)
+    records->push_back(records_[i % records_.size()]);
+
+  // drop records the writer reached while we copied, including the one it
+  // may be writing right now; they may be torn
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t reached = count_.load(std::memory_order_relaxed) + 1;
+  uint64_t overwritten = reached > begin + records_.size()
+                             ? reached - begin - records_.size()
+                             : 0;
+  overwritten = std::min<uint64_t>(overwritten, records->size());
+  records->erase(records->begin(), records->begin() + overwritten);
+}
+
+FrameProfiler::FrameProfiler(size_t history) : ring_(history) {
+  timer_queries_ = GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query;
+  if (!timer_queries_)
+    spdlog::info("no timer queries, profiling CPU time only");
+  for (auto &slot : slots_) {
+    slot.queries.fill(0);
+    if (timer_queries_)
+      glGenQueries(slot.queries.size(), slot.queries.data());
+  }
+}
+
+FrameProfiler::~FrameProfiler() {
+  if (timer_queries_)
+    for (auto &slot : slots_)
+      glDeleteQueries(slot.queries.size(), slot.queries.data());
+}
+
+void FrameProfiler::StartFrame(Clock::time_point now) {
+  FrameRecord &record = slots_[current_slot_].record;
+  record.frame = frame_;
+  record.cpu_ms = 0.0f;
+  record.input_latency_ms = -1.0f;
+  record.phase_cpu_ms.fill(-1.0f);
+  record.phase_gpu_ms.fill(-1.0f);
+  frame_start_ = now;
+  frame_open_ = true;
+}
+
+int FrameProfiler::PhaseIndex(const char *name) {
+  for (size_t i = 0; i < phases_.size(); ++i)
+    if (phases_[i] == name)
+      return i;
+  if (phases_.size() == FrameRecord::kMaxPhases) {
+    spdlog::warn("too many profiler phases, not timing {}", name);
+    return -1;
+  }
+  phases_.push_back(name);
+  return phases_.size() - 1;
+}
+
+void FrameProfiler::Begin(const char *name) {
+  auto now = Clock::now();
+  if (!frame_open_)
+    StartFrame(now);
+  End();
+
+  int phase = PhaseIndex(name);
+  if (phase < 0)
+    return;
+  open_phase_ = phase;
+  phase_start_ = now;
+  if (timer_queries_)
+    glBeginQuery(GL_TIME_ELAPSED, slots_[current_slot_].queries[phase]);
+}
+
+void FrameProfiler::End() {
+  if (open_phase_ < 0)
+    return;
+  if (timer_queries_)
+    glEndQuery(GL_TIME_ELAPSED);
+  // a phase run twice in a frame adds up its CPU time, but only the last
+  // run's query survives
+  float &cpu_ms = slots_[current_slot_].record.phase_cpu_ms[open_phase_];
+  cpu_ms = std::max(cpu_ms, 0.0f) + Milliseconds(Clock::now() - phase_start_);
+  open_phase_ = -1;
+}
+
+void FrameProfiler::EndFrame() {
+  if (!frame_open_)
+    StartFrame(Clock::now());
+  End();
+
+  auto now = Clock::now();
+  Slot &slot = slots_[current_slot_];
+  slot.record.cpu_ms = Milliseconds(now - frame_start_);
+  slot.pending = true;
+  ++frame_;
+  current_slot_ = (current_slot_ + 1) % kQueryLatency;
+
+  Collect();
+  // the GPU is more than kQueryLatency frames behind; give up on the
+  // oldest frame's GPU timings rather than wait for them
+  if (slots_[current_slot_].pending) {
+    Publish(slots_[current_slot_], false);
+    ++dropped_gpu_frames_;
+    oldest_slot_ = (current_slot_ + 1) % kQueryLatency;
+  }
+  StartFrame(now);
+}
+
+void FrameProfiler::SetInputLatency(float ms) {
+  if (!frame_open_)
+    StartFrame(Clock::now());
+  slots_[current_slot_].record.input_latency_ms = ms;
+}
+
+void FrameProfiler::Finish() { Collect(true); }
+
+void FrameProfiler::Collect(bool wait) {
+  while (slots_[oldest_slot_].pending) {
+    Slot &slot = slots_[oldest_slot_];
+    if (timer_queries_) {
+      bool available = true;
+      for (size_t i = 0; i < phases_.size() && available && !wait; ++i) {
+        if (slot.record.phase_cpu_ms[i] < 0.0f)
+          continue;
+        GLuint result = GL_FALSE;
+        glGetQueryObjectuiv(slot.queries[i], GL_QUERY_RESULT_AVAILABLE,
+                            &result);
+        available = result == GL_TRUE;
+      }
+      if (!available)
+        return;
+      for (size_t i = 0; i < phases_.size(); ++i) {
+        if (slot.record.phase_cpu_ms[i] < 0.0f)
+          continue;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &nanoseconds);
+        slot.record.phase_gpu_ms[i] = nanoseconds * 1e-6;
+      }
+    }
+    Publish(slot, timer_queries_);
+    oldest_slot_ = (oldest_slot_ + 1) % kQueryLatency;
+  }
+}
+
+void FrameProfiler::Publish(Slot &slot, bool gpu_times) {
+  if (!gpu_times)
+    slot.record.phase_gpu_ms.fill(-1.0f);
+  ring_.Push(slot.record);
+  slot.pending = false;
+}
+
+void FrameProfiler::Report(const std::string &path) const {
+  std::vector<FrameRecord> frames;
+  ring_.Snapshot(&frames);
+  if (frames.empty())
+    return;
+
+  spdlog::info("profiled the last {} of {} frames, {} without GPU times",
+               frames.size(), ring_.count(), dropped_gpu_frames_);
+  spdlog::info("{:<12} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9}", "phase (ms)",
+               "cpu mean", "cpu p50", "cpu p95", "gpu mean", "gpu p50",
+               "gpu p95");
+  // the first frame pays for lazy driver setup (llvmpipe even times its
+  // first query from context creation), so it stays out of the summary
+  std::vector<float> cpu(frames.size()), gpu(frames.size());
+  for (size_t phase = 0; phase < phases_.size(); ++phase) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+      bool first = frames[i].frame == 0;
+      cpu[i] = first ? -1.0f : frames[i].phase_cpu_ms[phase];
+      gpu[i] = first ? -1.0f : frames[i].phase_gpu_ms[phase];
+    }
+    Summary cpu_summary = Summarize(cpu);
+    Summary gpu_summary = Summarize(gpu);
+    spdlog::info("{:<12} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f}",
+                 phases_[phase], cpu_summary.mean, cpu_summary.p50,
+                 cpu_summary.p95, gpu_summary.mean, gpu_summary.p50,
+                 gpu_summary.p95);
+  }
+  for (size_t i = 0; i < frames.size(); ++i)
+    cpu[i] = frames[i].frame == 0 ? -1.0f : frames[i].cpu_ms;
+  Summary frame = Summarize(cpu);
+  for (size_t i = 0; i < frames.size(); ++i)
+    cpu[i] = frames[i].input_latency_ms;
+  Summary latency = Summarize(cpu);
+  spdlog::info("{:<12} {:>9} {:>9} {:>9} {:>9} {:>9}", "total (ms)", "count",
+               "mean", "p50", "p95", "p99");
+  spdlog::info("{:<12} {:>9} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f}", "frame",
+               frame.count, frame.mean, frame.p50, frame.p95, frame.p99);
+  if (latency.count > 0)
+    spdlog::info("{:<12} {:>9} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f}",
+                 "input", latency.count, latency.mean, latency.p50,
+                 latency.p95, latency.p99);
+
+  if (path.empty())
+    return;
+  const std::string json = ".json";
+  if (path.size() >= json.size() &&
+      path.compare(path.size() - json.size(), json.size(), json) == 0)
+    WriteJson(path, frames);
+  else
+    WriteCsv(path, frames);
+}
+
+void FrameProfiler::WriteCsv(const std::string &path,
+                             const std::vector<FrameRecord> &frames) const {
+  auto file = OpenExport(path);
+  if (!file)
+    return;
+  std::string line = "frame,cpu_ms,input_latency_ms";
+  for (auto &phase : phases_)
+    line += fmt::format(",{0}_cpu_ms,{0}_gpu_ms", phase);
+  file->info(line);
+  for (auto &frame : frames) {
+    line = fmt::format("{},{:.4f},{}", frame.frame, frame.cpu_ms,
+                       CsvField(frame.input_latency_ms));
+    for (size_t i = 0; i < phases_.size(); ++i)
+      line += ',' + CsvField(frame.phase_cpu_ms[i]) + ',' +
+              CsvField(frame.phase_gpu_ms[i]);
+    file->info(line);
+  }
+  file->flush();
+  spdlog::info("wrote {} frames to {}", frames.size(), path);
+}
+
+void FrameProfiler::WriteJson(const std::string &path,
+                              const std::vector<FrameRecord> &frames) const {
+  auto file = OpenExport(path);
+  if (!file)
+    return;
+  std::string line = "{\"phases\": [";
+  for (size_t i = 0; i < phases_.size(); ++i)
+    line += (i ? ", " : "") + JsonString(phases_[i]);
+  file->info(line + "], \"frames\": [");
+  for (size_t f = 0; f < frames.size(); ++f) {
+    auto &frame = frames[f];
+    std::string cpu, gpu;
+    for (size_t i = 0; i < phases_.size(); ++i) {
+      cpu += (i ? ", " : "") + JsonNumber(frame.phase_cpu_ms[i]);
+      gpu += (i ? ", " : "") + JsonNumber(frame.phase_gpu_ms[i]);
+    }
+    file->info("{{\"frame\": {}, \"cpu_ms\": {:.4f}, "
+               "\"input_latency_ms\": {}, \"phase_cpu_ms\": [{}], "
+               "\"phase_gpu_ms\": [{}]}}{}",
+               frame.frame, frame.cpu_ms, JsonNumber(frame.input_latency_ms),
+               cpu, gpu,
+               f + 1 < frames.size() ? "," : "");
+  }
+  file->info("]}");
+  file->flush();
+  spdlog::info("wrote {} frames to {}", frames.size(), path);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Timings of one frame. Phases are indexed like FrameProfiler::phases();
+// a phase that did not run in the frame, or whose GPU time never arrived,
+// has a negative time.
+struct FrameRecord {
+  static constexpr int kMaxPhases = 16;
+
+  uint64_t frame = 0;
+  // from the end of the previous frame to the end of this one
+  float cpu_ms = 0.0f;
+  // from the first input event the frame responded to until it was
+  // presented, negative if there was none
+  float input_latency_ms = -1.0f;
+  std::array<float, kMaxPhases> phase_cpu_ms;
+  std::array<float, kMaxPhases> phase_gpu_ms;
+};
+
+// The most recent frames, written by the render thread and readable from
+// any other thread without locks. Push publishes a record with a release
+// store of the frame count; Snapshot copies the newest records and then
+// discards any the writer overwrote while they were being copied.
+class FrameRing {
+public:
+  explicit FrameRing(size_t capacity) : records_(capacity) {}
+
+  size_t capacity() const { return records_.size(); }
+  // Frames pushed so far, including the ones that no longer fit.
+  uint64_t count() const { return count_.load(std::memory_order_acquire); }
+
+  void Push(const FrameRecord &record);
+
+  // Replaces `records` with the retained frames, oldest first.
+  void Snapshot(std::vector<FrameRecord> *records) const;
+
+private:
+  std::vector<FrameRecord> records_;
+  std::atomic<uint64_t> count_{0};
+};
+
+// Measures where frame time goes. The frame loop marks named phases with
+// Begin, and each phase is timed on the CPU with a steady clock and on the
+// GPU with a GL_TIME_ELAPSED query:
+//
+//   profiler.Begin("update");
+//   ...
+//   profiler.Begin("draw");
+//   ...
+//   profiler.EndFrame();
+//
+// Elapsed-time queries cannot nest, so neither can phases: beginning a phase
+// ends the open one. Query objects come from a ring several frames deep and
+// results are only read once GL reports them available, so the profiler
+// never waits for the GPU. A frame is published to ring() when all of its
+// queries have landed, or without GPU times if they are still pending when
+// its queries have to be reused.
+class FrameProfiler {
+public:
+  // Must be created with the GL context current; keeps the last `history`
+  // frames.
+  explicit FrameProfiler(size_t history = 1024);
+  ~FrameProfiler();
+
+  FrameProfiler(const FrameProfiler &) = delete;
+  FrameProfiler &operator=(const FrameProfiler &) = delete;
+
+  // Ends the open phase, if any, and starts timing `name`. Phases are
+  // identified by name, so the same literal can be passed every frame.
+  void Begin(const char *name);
+  // Ends the open phase without starting another.
+  void End();
+  // Ends the open phase and the frame, and collects finished GPU timings.
+  void EndFrame();
+  // Records the input latency of the current frame.
+  void SetInputLatency(float ms);
+  // Waits for the GPU timings still in flight and publishes their frames.
+  // Only meant for shutdown, before reading ring() one last time.
+  void Finish();
+
+  const std::vector<std::string> &phases() const { return phases_; }
+  const FrameRing &ring() const { return ring_; }
+
+  // Logs mean, p50 and p95 of every phase, and p99 of the frame time and
+  // input latency, over the retained frames and, if `path` is not empty,
+  // writes the frames there as JSON when the path ends in ".json" and as
+  // CSV otherwise.
+  void Report(const std::string &path) const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // Frames whose GPU timings may still be in flight.
+  static constexpr int kQueryLatency = 4;
+
+  struct Slot {
+    FrameRecord record;
+    std::array<GLuint, FrameRecord::kMaxPhases> queries;
+    bool pending = false;
+  };
+
+  // Opens frame `frame_` in the current slot.
+  void StartFrame(Clock::time_point now);
+  int PhaseIndex(const char *name);
+  // Publishes the oldest pending frames whose queries are all available, or
+  // all pending frames if `wait`.
+  void Collect(bool wait = false);
+  void Publish(Slot &slot, bool gpu_times);
+
+  void WriteCsv(const std::string &path,
+                const std::vector<FrameRecord> &frames) const;
+  void WriteJson(const std::string &path,
+                 const std::vector<FrameRecord> &frames) const;
+
+  bool timer_queries_ = false;
+  std::vector<std::string> phases_;
+  std::array<Slot, kQueryLatency> slots_;
+  int current_slot_ = 0;
+  int oldest_slot_ = 0;
+  uint64_t frame_ = 0;
+
+  bool frame_open_ = false;
+  Clock::time_point frame_start_;
+  int open_phase_ = -1;
+  Clock::time_point phase_start_;
+
+  // frames published before their GPU timings arrived
+  uint64_t dropped_gpu_frames_ = 0;
+  FrameRing ring_;
+};
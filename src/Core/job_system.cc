@@ -0,0 +1,139 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+namespace {
+// how often an idle worker looks for work before it goes to sleep
+const int kIdleSpins = 64;
+
+// The deque of the current thread, when it is a worker.
+struct CurrentWorker {
+  const JobSystem *system = nullptr;
+  unsigned index = 0;
+};
+thread_local CurrentWorker current_worker;
+} // namespace
+
+JobSystem::JobSystem(unsigned thread_count) {
+  thread_count = std::max(thread_count, 1u);
+  for (unsigned i = 0; i < thread_count; ++i)
+    queues_.push_back(std::make_unique<Queue>());
+  for (unsigned i = 1; i < thread_count; ++i)
+    workers_.emplace_back([this, i] { Work(i); });
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+void JobSystem::ParallelFor(size_t count, size_t grain, const Body &body) {
+  grain = std::max<size_t>(grain, 1);
+  if (size() == 1 || count <= grain) {
+    for (size_t begin = 0; begin < count; begin += grain)
+      body(begin, std::min(count, begin + grain));
+    return;
+  }
+
+  std::atomic<size_t> remaining{count};
+  unsigned index = Index();
+  Run(index, {&body, 0, count, grain, &remaining});
+  // help out until the stolen ranges are done as well
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    Task task;
+    if (Pop(index, task) || Steal(index, task))
+      Run(index, task);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void JobSystem::Work(unsigned index) {
+  current_worker = {this, index};
+  for (;;) {
+    Task task;
+    if (Pop(index, task) || Steal(index, task)) {
+      Run(index, task);
+      continue;
+    }
+
+    bool found = false;
+    for (int spin = 0; spin < kIdleSpins && !found; ++spin) {
+      std::this_thread::yield();
+      found = queued_.load() > 0;
+    }
+    if (found)
+      continue;
+
+    // Push reads sleeping_ after bumping queued_, and we check queued_ after
+    // bumping sleeping_, so one of us always sees the other
+    sleeping_.fetch_add(1);
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+    sleeping_.fetch_sub(1);
+    if (stopping_)
+      return;
+  }
+}
+
+void JobSystem::Run(unsigned index, Task task) {
+  // keep the lower half and offer the upper half to thieves, splitting on
+  // grain boundaries
+  while (task.end - task.begin > task.grain) {
+    size_t half = (task.end - task.begin) / 2;
+    size_t middle =
+        task.begin + (half + task.grain - 1) / task.grain * task.grain;
+    Push(index, {task.body, middle, task.end, task.grain, task.remaining});
+    task.end = middle;
+  }
+  (*task.body)(task.begin, task.end);
+  task.remaining->fetch_sub(task.end - task.begin, std::memory_order_acq_rel);
+}
+
+void JobSystem::Push(unsigned index, const Task &task) {
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(task);
+  }
+  queued_.fetch_add(1);
+  if (sleeping_.load() > 0) {
+    // taking the lock orders this with a worker about to wait
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    wake_.notify_one();
+  }
+}
+
+bool JobSystem::Pop(unsigned index, Task &task) {
+  Queue &queue = *queues_[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty())
+    return false;
+  task = queue.tasks.back();
+  queue.tasks.pop_back();
+  queued_.fetch_sub(1);
+  return true;
+}
+
+bool JobSystem::Steal(unsigned index, Task &task) {
+  for (unsigned offset = 1; offset < size(); ++offset) {
+    Queue &queue = *queues_[(index + offset) % size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      continue;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    queued_.fetch_sub(1);
+    steals_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+unsigned JobSystem::Index() const {
+  return current_worker.system == this ? current_worker.index : 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing scheduler for the data-parallel parts of a frame, like
+// updating thousands of transforms. Every thread owns a deque of ranges.
+// Running a range larger than the grain splits it in half, pushes the upper
+// half onto the owner's deque and keeps going with the lower half; idle
+// threads steal the oldest, and so largest, ranges from the front of other
+// deques. The thread calling ParallelFor takes part as thread 0, so a
+// system of size 1 runs everything inline, and it only returns when the
+// whole range is done.
+//
+// Deques are guarded by one small lock each. Workers spin briefly when they
+// run out of work, then sleep until more is pushed, so they cost nothing
+// between frames.
+class JobSystem {
+public:
+  using Body = std::function<void(size_t begin, size_t end)>;
+
+  explicit JobSystem(
+      unsigned thread_count = std::thread::hardware_concurrency());
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // Threads taking part in a loop, including the caller.
+  unsigned size() const { return queues_.size(); }
+
+  // Calls `body(begin, end)` on disjoint ranges covering [0, count), each
+  // at most `grain` long, and returns once all of them have finished.
+  // Call from the thread that created the system, or from inside a body.
+  void ParallelFor(size_t count, size_t grain, const Body &body);
+
+  // Ranges taken from another thread's deque since construction.
+  uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+  struct Task {
+    const Body *body;
+    size_t begin;
+    size_t end;
+    size_t grain;
+    std::atomic<size_t> *remaining;
+  };
+
+  struct alignas(64) Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void Work(unsigned index);
+  void Run(unsigned index, Task task);
+  void Push(unsigned index, const Task &task);
+  bool Pop(unsigned index, Task &task);
+  bool Steal(unsigned index, Task &task);
+  // This thread's deque: its worker index, or 0 for the owning thread.
+  unsigned Index() const;
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+
+  // tasks sitting in any deque, so sleepers know when to wake
+  std::atomic<size_t> queued_{0};
+  std::atomic<unsigned> sleeping_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+
+  std::atomic<uint64_t> steals_{0};
+};
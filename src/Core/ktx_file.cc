@@ -0,0 +1,301 @@
+#include "ktx_file.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <tuple>
+#include <vector>
+
+namespace {
+const unsigned char kIdentifier[12] = {0xab, 'K',  'T',  'X', ' ',  '2',
+                                       '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+
+// VkFormat values of the block formats
+const uint32_t kVkFormatBC1RgbUnorm = 131;
+const uint32_t kVkFormatBC3Unorm = 137;
+const uint32_t kVkFormatBC7Unorm = 145;
+
+// Khronos data format descriptor values
+const uint32_t kColorModelBC1A = 128;
+const uint32_t kColorModelBC3 = 130;
+const uint32_t kColorModelBC7 = 134;
+const uint32_t kPrimariesBT709 = 1;
+const uint32_t kTransferLinear = 1;
+const uint32_t kChannelColor = 0;
+const uint32_t kChannelBC3Alpha = 15;
+
+struct Header {
+  uint32_t vk_format;
+  uint32_t type_size;
+  uint32_t pixel_width;
+  uint32_t pixel_height;
+  uint32_t pixel_depth;
+  uint32_t layer_count;
+  uint32_t face_count;
+  uint32_t level_count;
+  uint32_t supercompression_scheme;
+};
+
+struct Index {
+  uint32_t dfd_byte_offset;
+  uint32_t dfd_byte_length;
+  uint32_t kvd_byte_offset;
+  uint32_t kvd_byte_length;
+  uint64_t sgd_byte_offset;
+  uint64_t sgd_byte_length;
+};
+
+struct Level {
+  uint64_t byte_offset;
+  uint64_t byte_length;
+  uint64_t uncompressed_byte_length;
+};
+
+uint32_t VkFormat(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::kBC1:
+    return kVkFormatBC1RgbUnorm;
+  case BlockFormat::kBC3:
+    return kVkFormatBC3Unorm;
+  case BlockFormat::kBC7:
+    return kVkFormatBC7Unorm;
+  }
+  return 0;
+}
+
+// The data format descriptor, a basic block describing how the bits of a
+// texel block map to channels, preceded by its total size.
+std::vector<uint32_t> FormatDescriptor(BlockFormat format) {
+  // (bit offset, bit length, channel) of each sample
+  std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> samples;
+  uint32_t color_model = 0;
+  switch (format) {
+  case BlockFormat::kBC1:
+    color_model = kColorModelBC1A;
+    samples = {{0, 64, kChannelColor}};
+    break;
+  case BlockFormat::kBC3:
+    color_model = kColorModelBC3;
+    samples = {{0, 64, kChannelBC3Alpha}, {64, 64, kChannelColor}};
+    break;
+  case BlockFormat::kBC7:
+    color_model = kColorModelBC7;
+    samples = {{0, 128, kChannelColor}};
+    break;
+  }
+  uint32_t block_size = 24 + 16 * samples.size();
+  std::vector<uint32_t> words = {
+      4 + block_size,
+      // vendor and descriptor type, both Khronos basic
+      0,
+      2 | block_size << 16,
+      color_model | kPrimariesBT709 << 8 | kTransferLinear << 16,
+      // block dimensions minus one
+      uint32_t(kBlockSize - 1) | uint32_t(kBlockSize - 1) << 8,
+      uint32_t(BlockBytes(format)),
+      0};
+  for (auto [offset, length, channel] : samples) {
+    words.push_back(offset | (length - 1) << 16 | channel << 24);
+    words.push_back(0);
+    words.push_back(0);
+    words.push_back(0xffffffff);
+  }
+  return words;
+}
+
+size_t Align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+bool ReadAt(const std::vector<char> &file, size_t offset, T *value) {
+  if (offset > file.size() || file.size() - offset < sizeof(T))
+    return false;
+  std::memcpy(value, file.data() + offset, sizeof(T));
+  return true;
+}
+} // namespace
+
+bool WriteKtx2(const std::string &path, const CompressedImage &image,
+               const std::map<std::string, std::string> &metadata) {
+  int level_count = MipLevelCount(image.width, image.height);
+  std::vector<uint32_t> descriptor = FormatDescriptor(image.format);
+
+  // key and value, each NUL terminated, padded to 4 bytes
+  std::map<std::string, std::string> entries = metadata;
+  entries["KTXwriter"] = "gltest";
+  std::vector<char> key_values;
+  for (auto &[key, value] : entries) {
+    uint32_t length = key.size() + value.size() + 2;
+    const char *bytes = reinterpret_cast<const char *>(&length);
+    key_values.insert(key_values.end(), bytes, bytes + sizeof(length));
+    key_values.insert(key_values.end(), key.c_str(),
+                      key.c_str() + key.size() + 1);
+    key_values.insert(key_values.end(), value.c_str(),
+                      value.c_str() + value.size() + 1);
+    key_values.resize(Align(key_values.size(), 4));
+  }
+
+  Header header{VkFormat(image.format),
+                1,
+                uint32_t(image.width),
+                uint32_t(image.height),
+                0,
+                0,
+                1,
+                uint32_t(level_count),
+                0};
+  Index index{};
+  index.dfd_byte_offset =
+      sizeof(kIdentifier) + sizeof(Header) + sizeof(Index) +
+      sizeof(Level) * level_count;
+  index.dfd_byte_length = sizeof(uint32_t) * descriptor.size();
+  index.kvd_byte_offset = index.dfd_byte_offset + index.dfd_byte_length;
+  index.kvd_byte_length = key_values.size();
+
+  // levels are stored smallest first, each aligned to a block
+  std::vector<Level> levels(level_count);
+  std::vector<size_t> sources(level_count);
+  size_t source = 0;
+  for (int level = 0; level < level_count; ++level) {
+    sources[level] = source;
+    source += LevelSize(image.format, image.width, image.height, level);
+  }
+  size_t offset = index.kvd_byte_offset + index.kvd_byte_length;
+  for (int level = level_count - 1; level >= 0; --level) {
+    size_t size = LevelSize(image.format, image.width, image.height, level);
+    offset = Align(offset, BlockBytes(image.format));
+    levels[level] = {offset, size, size};
+    offset += size;
+  }
+
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(kIdentifier),
+               sizeof(kIdentifier));
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(&index), sizeof(index));
+    file.write(reinterpret_cast<const char *>(levels.data()),
+               sizeof(Level) * levels.size());
+    file.write(reinterpret_cast<const char *>(descriptor.data()),
+               index.dfd_byte_length);
+    file.write(key_values.data(), key_values.size());
+    size_t position = index.kvd_byte_offset + index.kvd_byte_length;
+    const char padding[16] = {};
+    for (int level = level_count - 1; level >= 0; --level) {
+      file.write(padding, levels[level].byte_offset - position);
+      file.write(reinterpret_cast<const char *>(image.data.data()) +
+                     sources[level],
+                 levels[level].byte_length);
+      position = levels[level].byte_offset + levels[level].byte_length;
+    }
+    if (!file) {
+      spdlog::warn("could not write KTX2 file {}", temporary);
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    spdlog::warn("could not replace KTX2 file {}", path);
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ReadKtx2(const std::string &path, CompressedImage *image,
+              std::map<std::string, std::string> *metadata) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream)
+    return false;
+  std::vector<char> file((std::istreambuf_iterator<char>(stream)),
+                         std::istreambuf_iterator<char>());
+
+  Header header;
+  Index index;
+  if (file.size() < sizeof(kIdentifier) ||
+      std::memcmp(file.data(), kIdentifier, sizeof(kIdentifier)) != 0 ||
+      !ReadAt(file, sizeof(kIdentifier), &header) ||
+      !ReadAt(file, sizeof(kIdentifier) + sizeof(Header), &index)) {
+    spdlog::warn("ignoring KTX2 file {}: bad header", path);
+    return false;
+  }
+  if (header.vk_format == kVkFormatBC1RgbUnorm) {
+    image->format = BlockFormat::kBC1;
+  } else if (header.vk_format == kVkFormatBC3Unorm) {
+    image->format = BlockFormat::kBC3;
+  } else if (header.vk_format == kVkFormatBC7Unorm) {
+    image->format = BlockFormat::kBC7;
+  } else {
+    spdlog::warn("ignoring KTX2 file {}: unsupported format {}", path,
+                 header.vk_format);
+    return false;
+  }
+  if (header.pixel_width == 0 || header.pixel_height == 0 ||
+      header.pixel_width > INT32_MAX || header.pixel_height > INT32_MAX ||
+      header.pixel_depth != 0 || header.layer_count != 0 ||
+      header.face_count != 1 || header.supercompression_scheme != 0 ||
+      int(header.level_count) !=
+          MipLevelCount(header.pixel_width, header.pixel_height)) {
+    spdlog::warn("ignoring KTX2 file {}: not a 2D image with a full mip "
+                 "chain",
+                 path);
+    return false;
+  }
+  image->width = header.pixel_width;
+  image->height = header.pixel_height;
+
+  std::vector<Level> levels(header.level_count);
+  size_t size = 0;
+  for (uint32_t level = 0; level < header.level_count; ++level) {
+    if (!ReadAt(file,
+                sizeof(kIdentifier) + sizeof(Header) + sizeof(Index) +
+                    sizeof(Level) * level,
+                &levels[level]) ||
+        levels[level].byte_length !=
+            LevelSize(image->format, image->width, image->height, level) ||
+        levels[level].byte_offset > file.size() ||
+        file.size() - levels[level].byte_offset < levels[level].byte_length) {
+      spdlog::warn("ignoring KTX2 file {}: bad level {}", path, level);
+      return false;
+    }
+    size += levels[level].byte_length;
+  }
+  image->data.resize(size);
+  size_t offset = 0;
+  for (const Level &level : levels) {
+    std::memcpy(image->data.data() + offset, file.data() + level.byte_offset,
+                level.byte_length);
+    offset += level.byte_length;
+  }
+
+  metadata->clear();
+  size_t end = size_t(index.kvd_byte_offset) + index.kvd_byte_length;
+  if (end > file.size()) {
+    spdlog::warn("ignoring KTX2 file {}: truncated key/value data", path);
+    return false;
+  }
+  for (size_t at = index.kvd_byte_offset; at + sizeof(uint32_t) <= end;) {
+    uint32_t length = 0;
+    ReadAt(file, at, &length);
+    at += sizeof(length);
+    if (length > end - at)
+      break;
+    // the key ends at the first NUL, the value may end with one
+    std::string entry(file.data() + at, length);
+    size_t separator = entry.find('\0');
+    if (separator != std::string::npos) {
+      std::string value = entry.substr(separator + 1);
+      if (!value.empty() && value.back() == '\0')
+        value.pop_back();
+      (*metadata)[entry.substr(0, separator)] = value;
+    }
+    at = Align(at + length, 4);
+  }
+  return true;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "block_compression.h"
+
+// Reads and writes block compressed images as KTX2 files, the Khronos
+// container for GPU textures, so tools like ktx info or RenderDoc open
+// them too. Only what CompressMipChain produces is supported: a 2D image
+// of BC1, BC3 or BC7 blocks with its full mip chain and no supercompression.
+//
+// Metadata is the file's key/value data, as strings. Keys starting with
+// "KTX" are defined by the format, and the writer sets KTXwriter itself.
+
+// Writes `image` and `metadata` to `path`, through a temporary file so a
+// crash never leaves a truncated one behind. Returns false after logging
+// the reason.
+bool WriteKtx2(const std::string &path, const CompressedImage &image,
+               const std::map<std::string, std::string> &metadata);
+
+// Reads a file written by WriteKtx2. Returns false if there is none, or
+// after logging why it cannot be used.
+bool ReadKtx2(const std::string &path, CompressedImage *image,
+              std::map<std::string, std::string> *metadata);
@@ -0,0 +1,229 @@
+#include "program_cache.h"
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+namespace {
+const char kMagic[4] = {'G', 'L', 'P', 'B'};
+const uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t hash;
+  uint32_t format;
+  uint32_t length;
+};
+
+void LogShaderInfo(GLuint shader_id) {
+  int max_length = 2048;
+  int actual_length = 0;
+  char buffer[2048];
+  glGetShaderInfoLog(shader_id, max_length, &actual_length, buffer);
+  spdlog::error("shader info log for GL index {}:\n{}", shader_id, buffer);
+}
+
+void LogProgramInfo(GLuint program) {
+  int max_length = 2048;
+  int actual_length = 0;
+  char program_log[2048];
+  glGetProgramInfoLog(program, max_length, &actual_length, program_log);
+  spdlog::error("program info log for GL index {}:\n{}", program, program_log);
+}
+
+// 64-bit FNV-1a; only has to tell programs apart, not resist attacks
+uint64_t Hash(const std::string &data,
+              uint64_t hash = 0xcbf29ce484222325ull) {
+  for (unsigned char byte : data) {
+    hash ^= byte;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string GetString(GLenum name) {
+  auto *value = reinterpret_cast<const char *>(glGetString(name));
+  return value ? value : "";
+}
+
+// Compiles and links `stages`, or returns 0 after logging why it failed.
+GLuint Build(const std::vector<ShaderStage> &stages, bool retrievable) {
+  std::vector<GLuint> shaders;
+  bool compiled = true;
+  for (auto &stage : stages) {
+    GLuint shader = glCreateShader(stage.type);
+    glShaderSource(shader, 1, &stage.source, NULL);
+    glCompileShader(shader);
+    int params = -1;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &params);
+    if (GL_TRUE != params) {
+      spdlog::error("GL shader index {} did not compile", shader);
+      LogShaderInfo(shader);
+      compiled = false;
+    }
+    shaders.push_back(shader);
+  }
+
+  GLuint program = 0;
+  if (compiled) {
+    program = glCreateProgram();
+    if (retrievable)
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                          GL_TRUE);
+    for (GLuint shader : shaders)
+      glAttachShader(program, shader);
+    glLinkProgram(program);
+    int params = -1;
+    glGetProgramiv(program, GL_LINK_STATUS, &params);
+    if (GL_TRUE != params) {
+      spdlog::error("could not link shader program GL index {}", program);
+      LogProgramInfo(program);
+      glDeleteProgram(program);
+      program = 0;
+    } else {
+      for (GLuint shader : shaders)
+        glDetachShader(program, shader);
+    }
+  }
+
+  for (GLuint shader : shaders)
+    glDeleteShader(shader);
+  return program;
+}
+} // namespace
+
+ProgramCache::ProgramCache(std::string directory)
+    : directory_(std::move(directory)) {
+  driver_ = GetString(GL_VENDOR) + '\n' + GetString(GL_RENDERER) + '\n' +
+            GetString(GL_VERSION);
+
+  if (directory_.empty())
+    return;
+  if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary) {
+    spdlog::info("program binaries unavailable, compiling shaders every run");
+    return;
+  }
+  GLint format_count = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+  if (format_count <= 0) {
+    spdlog::info("driver has no program binary formats, compiling shaders "
+                 "every run");
+    return;
+  }
+  binaries_supported_ = true;
+}
+
+GLuint ProgramCache::Get(const std::vector<ShaderStage> &stages) {
+  std::string key;
+  for (auto &stage : stages) {
+    key += std::to_string(stage.type);
+    key += '\0';
+    key += stage.source;
+    key += '\0';
+  }
+  if (auto it = programs_.find(key); it != programs_.end())
+    return it->second;
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+
+  uint64_t hash = Hash(key, Hash(driver_));
+  GLuint program = binaries_supported_ ? Load(hash) : 0;
+  bool loaded = program != 0;
+  if (!loaded) {
+    program = Build(stages, binaries_supported_);
+    if (!program)
+      return 0;
+    if (binaries_supported_)
+      Store(hash, program);
+  }
+
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+  spdlog::info("program {} {} in {:.3f} ms", program,
+               loaded ? "loaded from binary cache" : "compiled from source",
+               elapsed.count());
+  programs_.emplace(std::move(key), program);
+  return program;
+}
+
+GLuint ProgramCache::Load(uint64_t hash) {
+  std::string path = PathFor(hash);
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return 0;
+
+  FileHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.hash != hash) {
+    spdlog::warn("ignoring program binary {}: bad header", path);
+    return 0;
+  }
+  std::vector<char> binary(header.length);
+  if (!file.read(binary.data(), binary.size())) {
+    spdlog::warn("ignoring program binary {}: truncated", path);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, binary.data(), binary.size());
+  int params = -1;
+  glGetProgramiv(program, GL_LINK_STATUS, &params);
+  if (GL_TRUE != params) {
+    spdlog::warn("driver rejected program binary {}, recompiling", path);
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void ProgramCache::Store(uint64_t hash, GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.hash = hash;
+  header.format = format;
+  header.length = length;
+
+  // write next to the final file and rename over it, so a crash never
+  // leaves a truncated binary behind
+  std::string path = PathFor(hash);
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(binary.data(), length);
+    if (!file) {
+      spdlog::warn("could not write program binary {}", temporary);
+      std::remove(temporary.c_str());
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    spdlog::warn("could not replace program binary {}", path);
+    std::remove(temporary.c_str());
+  }
+}
+
+std::string ProgramCache::PathFor(uint64_t hash) const {
+  return fmt::format("{}/{:016x}.bin", directory_, hash);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// One stage of a program: GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...
+struct ShaderStage {
+  GLenum type;
+  const char *source;
+};
+
+// Creates the shader programs of a demo. Asking twice for the same stages
+// returns the same program, and linked programs are written to disk with
+// glGetProgramBinary so later runs load them with glProgramBinary instead of
+// compiling GLSL. Binaries are keyed by a hash of the sources and of the
+// vendor, renderer and version strings, so a driver update or an edited
+// shader simply misses the cache. A binary the driver refuses is rebuilt
+// from source and replaced.
+//
+// Programs stay alive until the context is destroyed.
+class ProgramCache {
+public:
+  static constexpr const char *kDefaultDirectory = "shader_cache";
+
+  // Must be created with the GL context current. An empty `directory`
+  // disables the disk cache.
+  explicit ProgramCache(std::string directory = kDefaultDirectory);
+
+  ProgramCache(const ProgramCache &) = delete;
+  ProgramCache &operator=(const ProgramCache &) = delete;
+
+  // Returns the linked program, or 0 if a stage does not compile or the
+  // program does not link; the info logs are written to spdlog.
+  GLuint Get(const std::vector<ShaderStage> &stages);
+
+private:
+  GLuint Load(uint64_t hash);
+  void Store(uint64_t hash, GLuint program);
+  std::string PathFor(uint64_t hash) const;
+
+  std::string directory_;
+  std::string driver_;
+  bool binaries_supported_ = false;
+  // the concatenated stage types and sources of every program handed out
+  std::map<std::string, GLuint> programs_;
+};
@@ -0,0 +1,216 @@
+#include "render_queue.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+
+#include "debug_output.h"
+
+namespace {
+// room for this many draws in the first command buffer
+const size_t kInitialCommands = 1024;
+
+// DrawElementsIndirectCommand; arrays draws use the first four fields as a
+// DrawArraysIndirectCommand, so both kinds share one stride
+struct Command {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+bool Mergeable(const RenderQueue::Item &a, const RenderQueue::Item &b) {
+  return a.program == b.program && a.vao == b.vao && a.texture == b.texture &&
+         a.mode == b.mode && a.index_type == b.index_type;
+}
+
+size_t IndexSize(GLenum type) {
+  switch (type) {
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  case GL_UNSIGNED_SHORT:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+const void *IndexOffset(const RenderQueue::Item &item) {
+  return reinterpret_cast<const void *>(item.first *
+                                        IndexSize(item.index_type));
+}
+} // namespace
+
+RenderQueue::RenderQueue() {
+  indirect_ = GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_multi_draw_indirect;
+  if (!indirect_)
+    spdlog::info("ARB_multi_draw_indirect unavailable, render queue merges "
+                 "only plain draws");
+}
+
+uint64_t RenderQueue::Key(const Item &item, float depth) {
+  const uint64_t kDepthMax = (uint64_t(1) << 24) - 1;
+  uint64_t depth_bits =
+      uint64_t(std::min(std::max(depth, 0.0f), 1.0f) * kDepthMax);
+  return uint64_t(item.program & 0xfff) << 52 |
+         uint64_t(item.vao & 0xfff) << 40 |
+         uint64_t(item.texture & 0xffff) << 24 | depth_bits;
+}
+
+void RenderQueue::Submit(const Item &item, float depth) {
+  entries_.push_back({Key(item, depth), uint32_t(items_.size())});
+  items_.push_back(item);
+}
+
+void RenderQueue::Flush(RenderState &state) {
+  last_items_ = items_.size();
+  last_draw_calls_ = 0;
+  if (items_.empty())
+    return;
+
+  Sort();
+  GLintptr commands = indirect_ ? WriteCommands(state) : -1;
+  for (size_t begin = 0; begin < entries_.size();) {
+    const Item &item = items_[entries_[begin].item];
+    size_t end = begin + 1;
+    while (end < entries_.size() &&
+           Mergeable(item, items_[entries_[end].item]))
+      ++end;
+
+    state.UseProgram(item.program);
+    state.BindVertexArray(item.vao);
+    if (item.texture)
+      state.BindTexture(0, GL_TEXTURE_2D, item.texture);
+    if (commands >= 0)
+      DrawIndirect(begin, end, commands);
+    else
+      DrawDirect(begin, end);
+    begin = end;
+  }
+
+  items_.clear();
+  entries_.clear();
+}
+
+void RenderQueue::Sort() {
+  // least significant byte first; each pass is a stable counting sort
+  const int kPasses = sizeof(uint64_t);
+  size_t histograms[kPasses][256] = {};
+  for (const Entry &entry : entries_)
+    for (int pass = 0; pass < kPasses; ++pass)
+      ++histograms[pass][entry.key >> (8 * pass) & 0xff];
+
+  size_t size = entries_.size();
+  scratch_.resize(size);
+  for (int pass = 0; pass < kPasses; ++pass) {
+    size_t *histogram = histograms[pass];
+    int shift = 8 * pass;
+    // a byte every key shares would leave the order as it is
+    if (histogram[entries_[0].key >> shift & 0xff] == size)
+      continue;
+
+    size_t offset = 0;
+    for (int byte = 0; byte < 256; ++byte) {
+      size_t count = histogram[byte];
+      histogram[byte] = offset;
+      offset += count;
+    }
+    for (const Entry &entry : entries_)
+      scratch_[histogram[entry.key >> shift & 0xff]++] = entry;
+    entries_.swap(scratch_);
+  }
+}
+
+GLintptr RenderQueue::WriteCommands(RenderState &state) {
+  size_t bytes = sizeof(Command) * entries_.size();
+  if (!commands_ || commands_->region_size() < bytes) {
+    size_t size = sizeof(Command) * kInitialCommands;
+    if (commands_)
+      size = commands_->region_size();
+    while (size < bytes)
+      size *= 2;
+    // the next buffer may get the old one's name, which must not look bound
+    state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    commands_.reset();
+    commands_ = std::make_unique<StreamBuffer>(size);
+    LabelObject(GL_BUFFER, commands_->buffer(), "render queue commands");
+  }
+
+  commands_->Begin();
+  auto allocation = commands_->Allocate(bytes, alignof(Command));
+  if (allocation.data) {
+    auto *command = static_cast<Command *>(allocation.data);
+    for (const Entry &entry : entries_) {
+      const Item &item = items_[entry.item];
+      if (item.index_type)
+        *command++ = {item.count, item.instance_count, item.first,
+                      item.base_vertex, item.base_instance};
+      else
+        *command++ = {item.count, item.instance_count, item.first,
+                      GLint(item.base_instance), 0};
+    }
+  }
+  commands_->End();
+  if (!allocation.data)
+    return -1;
+
+  state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_->buffer());
+  return allocation.offset;
+}
+
+void RenderQueue::DrawIndirect(size_t begin, size_t end, GLintptr commands) {
+  const Item &item = items_[entries_[begin].item];
+  auto offset = reinterpret_cast<const void *>(commands +
+                                               sizeof(Command) * begin);
+  if (item.index_type)
+    glMultiDrawElementsIndirect(item.mode, item.index_type, offset,
+                                end - begin, sizeof(Command));
+  else
+    glMultiDrawArraysIndirect(item.mode, offset, end - begin,
+                              sizeof(Command));
+  ++last_draw_calls_;
+}
+
+void RenderQueue::DrawDirect(size_t begin, size_t end) {
+  bool plain = true;
+  for (size_t i = begin; i < end && plain; ++i) {
+    const Item &item = items_[entries_[i].item];
+    plain = item.instance_count == 1 && item.base_instance == 0;
+  }
+
+  const Item &first = items_[entries_[begin].item];
+  if (plain && end - begin > 1) {
+    counts_.clear();
+    offsets_.clear();
+    firsts_.clear();
+    for (size_t i = begin; i < end; ++i) {
+      const Item &item = items_[entries_[i].item];
+      counts_.push_back(item.count);
+      offsets_.push_back(IndexOffset(item));
+      firsts_.push_back(item.index_type ? item.base_vertex : item.first);
+    }
+    if (first.index_type)
+      glMultiDrawElementsBaseVertex(first.mode, counts_.data(),
+                                    first.index_type, offsets_.data(),
+                                    end - begin, firsts_.data());
+    else
+      glMultiDrawArrays(first.mode, firsts_.data(), counts_.data(),
+                        end - begin);
+    ++last_draw_calls_;
+    return;
+  }
+
+  for (size_t i = begin; i < end; ++i) {
+    const Item &item = items_[entries_[i].item];
+    if (item.index_type)
+      glDrawElementsInstancedBaseVertexBaseInstance(
+          item.mode, item.count, item.index_type, IndexOffset(item),
+          item.instance_count, item.base_vertex, item.base_instance);
+    else
+      glDrawArraysInstancedBaseInstance(item.mode, item.first, item.count,
+                                        item.instance_count,
+                                        item.base_instance);
+    ++last_draw_calls_;
+  }
+}
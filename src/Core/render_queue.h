@@ -0,0 +1,96 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "render_state.h"
+#include "stream_buffer.h"
+
+// Collects the draws of a frame and issues them in an order that changes
+// as little state as possible. Every item gets a 64-bit key,
+//
+//   program:12 | vertex array:12 | texture:16 | depth:24
+//
+// from the high bits down, so sorting groups items by program first and
+// draws each group front to back. Object names wider than their field only
+// make the order less ideal; items are compared in full before merging.
+//
+// Flush radix sorts the keys, then merges runs of items sharing program,
+// vertex array, texture, mode and index type into one multi-draw. With
+// ARB_multi_draw_indirect a run is a single glMultiDraw*Indirect call whose
+// commands are streamed to the GPU, so every item keeps its own base
+// instance and instance count, which is how per-object data reaches the
+// shaders. Without it, runs of single, non-instanced items become
+// glMultiDrawElementsBaseVertex or glMultiDrawArrays calls and the others
+// are drawn one by one.
+class RenderQueue {
+public:
+  struct Item {
+    GLuint program = 0;
+    GLuint vao = 0;
+    // bound to unit 0 when not 0
+    GLuint texture = 0;
+    GLenum mode = GL_TRIANGLES;
+    // GL_UNSIGNED_BYTE, _SHORT or _INT for indexed draws, 0 for arrays
+    GLenum index_type = 0;
+    GLuint count = 0;
+    // first index or first vertex
+    GLuint first = 0;
+    GLint base_vertex = 0;
+    GLuint instance_count = 1;
+    GLuint base_instance = 0;
+  };
+
+  // Must be created and destroyed with the GL context current.
+  RenderQueue();
+
+  RenderQueue(const RenderQueue &) = delete;
+  RenderQueue &operator=(const RenderQueue &) = delete;
+
+  // The sort key of `item` at `depth`, from 0 at the near plane to 1 at the
+  // far one; depths outside are clamped.
+  static uint64_t Key(const Item &item, float depth);
+
+  void Submit(const Item &item, float depth);
+
+  // Sorts and draws everything submitted since the last flush, through
+  // `state`, and empties the queue.
+  void Flush(RenderState &state);
+
+  bool indirect() const { return indirect_; }
+  // Items drawn and GL draw calls made by the last flush.
+  size_t last_items() const { return last_items_; }
+  size_t last_draw_calls() const { return last_draw_calls_; }
+
+private:
+  struct Entry {
+    uint64_t key;
+    uint32_t item;
+  };
+
+  void Sort();
+  // Streams the commands of all sorted items, returning their offset in
+  // commands_, or -1 if they could not be written.
+  GLintptr WriteCommands(RenderState &state);
+  // Draw the sorted items [begin, end), which share all draw state.
+  void DrawIndirect(size_t begin, size_t end, GLintptr commands);
+  void DrawDirect(size_t begin, size_t end);
+
+  bool indirect_ = false;
+  std::vector<Item> items_;
+  std::vector<Entry> entries_;
+  std::vector<Entry> scratch_;
+  std::unique_ptr<StreamBuffer> commands_;
+
+  // gathered per run for the non-indirect multi-draws
+  std::vector<GLsizei> counts_;
+  std::vector<const void *> offsets_;
+  std::vector<GLint> firsts_;
+
+  size_t last_items_ = 0;
+  size_t last_draw_calls_ = 0;
+};
@@ -0,0 +1,169 @@
+#include "render_state.h"
+
+#include <cstring>
+
+namespace {
+// shadow value of state that may be anything
+const GLuint kUnknown = ~GLuint(0);
+
+const GLenum kTrackedBuffers[] = {
+    GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER,
+    GL_PIXEL_UNPACK_BUFFER, GL_DRAW_INDIRECT_BUFFER};
+const GLenum kTrackedTextures[] = {GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY,
+                                   GL_TEXTURE_CUBE_MAP, GL_TEXTURE_3D};
+const GLenum kTrackedCapabilities[] = {GL_DEPTH_TEST, GL_CULL_FACE,
+                                       GL_BLEND, GL_SCISSOR_TEST};
+} // namespace
+
+RenderState::RenderState() { Invalidate(); }
+
+template <typename T> bool RenderState::Change(T &shadow, T value) {
+  if (shadow == value) {
+    ++frame_.skipped;
+    return false;
+  }
+  ++frame_.issued;
+  shadow = value;
+  return true;
+}
+
+void RenderState::UseProgram(GLuint program) {
+  if (Change(program_, program))
+    glUseProgram(program);
+}
+
+void RenderState::BindVertexArray(GLuint vao) {
+  if (!Change(vao_, vao))
+    return;
+  glBindVertexArray(vao);
+  buffers_[BufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = kUnknown;
+}
+
+void RenderState::BindBuffer(GLenum target, GLuint buffer) {
+  int slot = BufferSlot(target);
+  if (slot < 0) {
+    ++frame_.issued;
+    glBindBuffer(target, buffer);
+  } else if (Change(buffers_[slot], buffer)) {
+    glBindBuffer(target, buffer);
+  }
+}
+
+void RenderState::BindBufferRange(GLenum target, GLuint index, GLuint buffer,
+                                  GLintptr offset, GLsizeiptr size) {
+  if (target != GL_UNIFORM_BUFFER || index >= kBufferBindings) {
+    ++frame_.issued;
+    glBindBufferRange(target, index, buffer, offset, size);
+    return;
+  }
+  if (!Change(uniform_ranges_[index], Range{buffer, offset, size}))
+    return;
+  glBindBufferRange(target, index, buffer, offset, size);
+  // binding a range binds the generic target too
+  buffers_[BufferSlot(GL_UNIFORM_BUFFER)] = buffer;
+}
+
+void RenderState::BindTexture(GLuint unit, GLenum target, GLuint texture) {
+  int slot = TextureSlot(target);
+  if (slot >= 0 && unit < kTextureUnits &&
+      textures_[unit][slot] == texture) {
+    ++frame_.skipped;
+    return;
+  }
+  if (Change(active_unit_, unit))
+    glActiveTexture(GL_TEXTURE0 + unit);
+  ++frame_.issued;
+  glBindTexture(target, texture);
+  if (slot >= 0 && unit < kTextureUnits)
+    textures_[unit][slot] = texture;
+}
+
+void RenderState::Enable(GLenum capability, bool enabled) {
+  for (int i = 0; i < kCapabilities; ++i) {
+    if (kTrackedCapabilities[i] != capability)
+      continue;
+    if (!Change(capabilities_[i], int(enabled)))
+      return;
+    break;
+  }
+  if (enabled)
+    glEnable(capability);
+  else
+    glDisable(capability);
+}
+
+void RenderState::Uniform1i(GLint location, GLint value) {
+  if (ChangeUniform(location, &value, sizeof(value)))
+    glUniform1i(location, value);
+}
+
+void RenderState::Uniform1f(GLint location, GLfloat value) {
+  if (ChangeUniform(location, &value, sizeof(value)))
+    glUniform1f(location, value);
+}
+
+void RenderState::Uniform4fv(GLint location, const GLfloat *value) {
+  if (ChangeUniform(location, value, 4 * sizeof(GLfloat)))
+    glUniform4fv(location, 1, value);
+}
+
+void RenderState::UniformMatrix4fv(GLint location, const GLfloat *value) {
+  if (ChangeUniform(location, value, 16 * sizeof(GLfloat)))
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
+
+void RenderState::Invalidate() {
+  program_ = kUnknown;
+  vao_ = kUnknown;
+  for (GLuint &buffer : buffers_)
+    buffer = kUnknown;
+  for (Range &range : uniform_ranges_)
+    range = {kUnknown, 0, 0};
+  active_unit_ = kUnknown;
+  for (auto &unit : textures_)
+    for (GLuint &texture : unit)
+      texture = kUnknown;
+  for (int &capability : capabilities_)
+    capability = -1;
+  uniforms_.clear();
+}
+
+void RenderState::EndFrame() {
+  last_frame_ = frame_;
+  total_.issued += frame_.issued;
+  total_.skipped += frame_.skipped;
+  frame_ = Counts();
+  ++frames_;
+}
+
+bool RenderState::ChangeUniform(GLint location, const void *value,
+                                size_t size) {
+  // values are kept per program, so they need a known one
+  if (location < 0 || program_ == kUnknown) {
+    ++frame_.issued;
+    return true;
+  }
+  uint64_t key = uint64_t(program_) << 32 | uint32_t(location);
+  auto [it, inserted] = uniforms_.try_emplace(key);
+  if (!inserted && std::memcmp(it->second.data, value, size) == 0) {
+    ++frame_.skipped;
+    return false;
+  }
+  ++frame_.issued;
+  std::memcpy(it->second.data, value, size);
+  return true;
+}
+
+int RenderState::BufferSlot(GLenum target) {
+  for (int i = 0; i < kBufferTargets; ++i)
+    if (kTrackedBuffers[i] == target)
+      return i;
+  return -1;
+}
+
+int RenderState::TextureSlot(GLenum target) {
+  for (int i = 0; i < kTextureTargets; ++i)
+    if (kTrackedTextures[i] == target)
+      return i;
+  return -1;
+}
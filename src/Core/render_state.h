@@ -0,0 +1,105 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+// Shadows the GL state a frame loop keeps setting, and skips calls that
+// would not change it: the program, the vertex array, buffer and texture
+// bindings, a few capabilities, and uniform values of each program.
+//
+// The shadow is only right while every change to that state goes through
+// it. Code that sets it directly, or deletes a bound object, must call
+// Invalidate afterwards; the next call of each kind is then issued again.
+// Binding targets that are not tracked, like the copy buffers StreamBuffer
+// uses, are always issued.
+//
+// Every call is counted as issued or skipped; EndFrame moves the counts of
+// the frame into last_frame() and the totals.
+class RenderState {
+public:
+  static constexpr int kTextureUnits = 16;
+  static constexpr int kBufferBindings = 16;
+
+  struct Counts {
+    uint64_t issued = 0;
+    uint64_t skipped = 0;
+  };
+
+  RenderState();
+
+  RenderState(const RenderState &) = delete;
+  RenderState &operator=(const RenderState &) = delete;
+
+  void UseProgram(GLuint program);
+  // Also forgets the element buffer, which belongs to the vertex array.
+  void BindVertexArray(GLuint vao);
+  void BindBuffer(GLenum target, GLuint buffer);
+  // Indexed uniform buffer bindings; other targets are issued as is.
+  void BindBufferRange(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size);
+  // Binds `texture` to `unit`, a number from 0 rather than GL_TEXTURE0,
+  // switching the active unit only when it has to.
+  void BindTexture(GLuint unit, GLenum target, GLuint texture);
+  void Enable(GLenum capability, bool enabled = true);
+  void Disable(GLenum capability) { Enable(capability, false); }
+
+  // Uniforms of the program in use.
+  void Uniform1i(GLint location, GLint value);
+  void Uniform1f(GLint location, GLfloat value);
+  void Uniform4fv(GLint location, const GLfloat *value);
+  void UniformMatrix4fv(GLint location, const GLfloat *value);
+
+  // Forgets everything, so the next call of each kind is issued.
+  void Invalidate();
+
+  // Ends the frame's counts.
+  void EndFrame();
+
+  const Counts &last_frame() const { return last_frame_; }
+  const Counts &total() const { return total_; }
+  uint64_t frames() const { return frames_; }
+
+private:
+  // Updates `shadow` to `value` and returns whether the call is needed.
+  template <typename T> bool Change(T &shadow, T value);
+  // The same for a uniform of the program in use, compared bytewise.
+  bool ChangeUniform(GLint location, const void *value, size_t size);
+  static int BufferSlot(GLenum target);
+  static int TextureSlot(GLenum target);
+
+  static constexpr int kBufferTargets = 5;
+  static constexpr int kTextureTargets = 4;
+  static constexpr int kCapabilities = 4;
+
+  struct Range {
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+    bool operator==(const Range &other) const {
+      return buffer == other.buffer && offset == other.offset &&
+             size == other.size;
+    }
+  };
+
+  struct UniformValue {
+    GLfloat data[16];
+  };
+
+  GLuint program_;
+  GLuint vao_;
+  GLuint buffers_[kBufferTargets];
+  Range uniform_ranges_[kBufferBindings];
+  GLuint active_unit_;
+  GLuint textures_[kTextureUnits][kTextureTargets];
+  int capabilities_[kCapabilities];
+  // keyed on program and location
+  std::unordered_map<uint64_t, UniformValue> uniforms_;
+
+  Counts frame_;
+  Counts last_frame_;
+  Counts total_;
+  uint64_t frames_ = 0;
+};
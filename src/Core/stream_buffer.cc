@@ -0,0 +1,112 @@
+#include "stream_buffer.h"
+
+#include <spdlog/spdlog.h>
+
+namespace {
+const GLbitfield kPersistentFlags =
+    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+} // namespace
+
+StreamBuffer::StreamBuffer(size_t region_size)
+    : region_size_((region_size + kRegionAlignment - 1) / kRegionAlignment *
+                   kRegionAlignment) {
+  persistent_ = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+  if (!persistent_)
+    spdlog::info("ARB_buffer_storage unavailable, orphaning stream buffer "
+                 "every frame");
+
+  // bound to the copy target so no binding a demo relies on changes
+  glGenBuffers(1, &buffer_);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+  if (persistent_) {
+    glBufferStorage(GL_COPY_WRITE_BUFFER, kRegions * region_size_, nullptr,
+                    kPersistentFlags);
+    data_ = static_cast<unsigned char *>(glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, kRegions * region_size_, kPersistentFlags));
+    if (!data_)
+      spdlog::error("could not map stream buffer");
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, region_size_, nullptr, GL_STREAM_DRAW);
+  }
+}
+
+StreamBuffer::~StreamBuffer() {
+  for (GLsync fence : fences_)
+    if (fence)
+      glDeleteSync(fence);
+  if (data_)
+    Unmap();
+  glDeleteBuffers(1, &buffer_);
+}
+
+void StreamBuffer::Begin() {
+  if (!persistent_) {
+    // the driver hands out fresh storage while the GPU still reads the old
+    region_ = 0;
+    used_ = 0;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+    glBufferData(GL_COPY_WRITE_BUFFER, region_size_, nullptr, GL_STREAM_DRAW);
+    Map();
+    return;
+  }
+
+  // every draw reading the previous region has been issued by now
+  if (region_ >= 0)
+    fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  region_ = (region_ + 1) % kRegions;
+  used_ = 0;
+
+  GLsync &fence = fences_[region_];
+  if (!fence)
+    return;
+  GLenum status = glClientWaitSync(fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    ++stalls_;
+    status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                              GLuint64(-1));
+  }
+  if (status == GL_WAIT_FAILED)
+    spdlog::error("waiting for stream buffer region {} failed", region_);
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+StreamBuffer::Allocation StreamBuffer::Allocate(size_t size,
+                                                size_t alignment) {
+  Allocation allocation;
+  if (!data_)
+    return allocation;
+
+  // align the offset in the buffer, which is what GL checks
+  size_t base = region_ * region_size_;
+  size_t offset = (base + used_ + alignment - 1) / alignment * alignment;
+  if (offset + size > base + region_size_) {
+    spdlog::error("stream buffer region of {} bytes is full", region_size_);
+    return allocation;
+  }
+  used_ = offset + size - base;
+
+  allocation.data = data_ + offset;
+  allocation.offset = offset;
+  return allocation;
+}
+
+void StreamBuffer::End() {
+  // coherent persistent writes need no flush
+  if (!persistent_)
+    Unmap();
+}
+
+void StreamBuffer::Map() {
+  data_ = static_cast<unsigned char *>(
+      glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, region_size_,
+                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  if (!data_)
+    spdlog::error("could not map stream buffer");
+}
+
+void StreamBuffer::Unmap() {
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+  glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+  data_ = nullptr;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// A buffer for data written by the CPU every frame: per-frame uniforms,
+// instance data, dynamic geometry. It is split into kRegions regions used
+// round robin, one per frame. With ARB_buffer_storage the whole buffer is
+// mapped once, persistently and coherently, so writes land directly in
+// memory the GPU reads; a fence placed after a frame's draws guards its
+// region until the GPU is done with it, so the CPU only waits when it gets
+// kRegions frames ahead. Without ARB_buffer_storage every frame orphans the
+// buffer with glBufferData and maps it again instead.
+//
+// Each frame writes everything first, then draws:
+//
+//   stream.Begin();
+//   auto frame = stream.Allocate(sizeof(Uniforms), alignment);
+//   std::memcpy(frame.data, &uniforms, sizeof(Uniforms));
+//   stream.End();
+//   glBindBufferRange(GL_UNIFORM_BUFFER, 0, stream.buffer(), frame.offset,
+//                     sizeof(Uniforms));
+//   glDraw...
+class StreamBuffer {
+public:
+  static constexpr int kRegions = 3;
+  // Regions start at multiples of this, the largest offset alignment GL
+  // allows for buffer bindings, so an aligned allocation at the start of any
+  // region fits just as in the first.
+  static constexpr size_t kRegionAlignment = 256;
+
+  struct Allocation {
+    // where to write; only valid until End()
+    void *data = nullptr;
+    // offset of `data` in buffer(), for glBindBufferRange, attribute
+    // pointers or draw offsets
+    GLintptr offset = 0;
+  };
+
+  // Must be created and destroyed with the GL context current.
+  // `region_size` is the most one frame can allocate, rounded up to a
+  // multiple of kRegionAlignment.
+  explicit StreamBuffer(size_t region_size);
+  ~StreamBuffer();
+
+  StreamBuffer(const StreamBuffer &) = delete;
+  StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+  GLuint buffer() const { return buffer_; }
+  bool persistent() const { return persistent_; }
+  size_t region_size() const { return region_size_; }
+  // Bytes left in this frame's region, before any alignment.
+  size_t available() const { return data_ ? region_size_ - used_ : 0; }
+  // How often Begin had to wait for the GPU to release a region.
+  uint64_t stalls() const { return stalls_; }
+
+  // Fences the previous frame's region and moves on to the next one.
+  void Begin();
+
+  // Returns `size` bytes of this frame's region at an offset that is a
+  // multiple of `alignment`, at most kRegionAlignment, or null data after
+  // logging an error when the region is full.
+  Allocation Allocate(size_t size, size_t alignment = 16);
+
+  // Makes this frame's writes visible to GL. Draws reading them come after.
+  void End();
+
+private:
+  void Map();
+  void Unmap();
+
+  bool persistent_ = false;
+  GLuint buffer_ = 0;
+  size_t region_size_ = 0;
+  unsigned char *data_ = nullptr;
+
+  int region_ = -1;
+  size_t used_ = 0;
+  GLsync fences_[kRegions] = {};
+  uint64_t stalls_ = 0;
+};
@@ -0,0 +1,277 @@
+#include "texture_manager.h"
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+#include "debug_output.h"
+
+namespace {
+const GLenum kFormats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+const GLenum kInternalFormats[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+// of staged pixels in the pixel buffer
+const size_t kStagingAlignment = 16;
+
+GLenum CompressedInternalFormat(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::kBC1:
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case BlockFormat::kBC3:
+    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  case BlockFormat::kBC7:
+    return GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+  return 0;
+}
+} // namespace
+
+TextureManager::TextureManager(bool bindless) {
+  bindless_ = bindless && GLAD_GL_ARB_bindless_texture;
+  if (bindless && !bindless_)
+    spdlog::info("ARB_bindless_texture unavailable, binding texture arrays");
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers_);
+  max_layers_ = std::min<GLint>(max_layers_, kLayersPerArray);
+
+  glGenBuffers(1, &table_);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, table_);
+  glBufferData(GL_COPY_WRITE_BUFFER, table_size(), nullptr, GL_STATIC_DRAW);
+  LabelObject(GL_BUFFER, table_, "texture table");
+}
+
+TextureManager::~TextureManager() {
+  for (GLuint64 handle : handles_)
+    if (handle)
+      glMakeTextureHandleNonResidentARB(handle);
+  glDeleteTextures(arrays_.size(), arrays_.data());
+  glDeleteBuffers(1, &table_);
+}
+
+int TextureManager::Add(int width, int height, int channels,
+                        const void *pixels) {
+  int index = Append(width, height, channels, std::nullopt);
+  if (index < 0)
+    return -1;
+  auto data = static_cast<const unsigned char *>(pixels);
+  pending_.back().pixels.assign(data,
+                                data + size_t(width) * height * channels);
+  return index;
+}
+
+int TextureManager::Reserve(int width, int height, int channels) {
+  return Append(width, height, channels, std::nullopt);
+}
+
+int TextureManager::Reserve(int width, int height, BlockFormat format) {
+  if (!Supports(format)) {
+    spdlog::error("{} textures are not supported", BlockFormatName(format));
+    return -1;
+  }
+  return Append(width, height, BlockChannels(format), format);
+}
+
+bool TextureManager::Supports(BlockFormat format) {
+  if (format == BlockFormat::kBC7)
+    return GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_compression_bptc;
+  return GLAD_GL_EXT_texture_compression_s3tc;
+}
+
+int TextureManager::Append(int width, int height, int channels,
+                           std::optional<BlockFormat> compression) {
+  if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+    spdlog::error("cannot make a texture of {}x{} pixels with {} channels",
+                  width, height, channels);
+    return -1;
+  }
+  if (size() >= kMaxTextures) {
+    spdlog::error("texture table is full at {} textures", kMaxTextures);
+    return -1;
+  }
+  pending_.push_back({width, height, channels, compression, {}});
+  return size() - 1;
+}
+
+void TextureManager::Update() {
+  if (pending_.empty())
+    return;
+
+  // same-sized images share arrays
+  std::map<std::tuple<int, int, int, std::optional<BlockFormat>>,
+           std::vector<size_t>>
+      groups;
+  for (size_t i = 0; i < pending_.size(); ++i)
+    groups[{pending_[i].width, pending_[i].height, pending_[i].channels,
+            pending_[i].compression}]
+        .push_back(i);
+
+  size_t base = entries_.size();
+  size_t first_array = arrays_.size();
+  entries_.resize(base + pending_.size());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (auto &[format, images] : groups) {
+    auto [width, height, channels, compression] = format;
+    for (size_t first = 0; first < images.size(); first += max_layers_) {
+      GLsizei layers =
+          std::min<size_t>(max_layers_, images.size() - first);
+      GLuint texture = 0;
+      glGenTextures(1, &texture);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+      LabelObject(GL_TEXTURE, texture,
+                  compression
+                      ? fmt::format("texture array {} ({}x{}, {})",
+                                    arrays_.size(), width, height,
+                                    BlockFormatName(*compression))
+                      : fmt::format("texture array {} ({}x{}, {} channels)",
+                                    arrays_.size(), width, height,
+                                    channels));
+      glTexStorage3D(GL_TEXTURE_2D_ARRAY, MipLevelCount(width, height),
+                     compression ? CompressedInternalFormat(*compression)
+                                 : kInternalFormats[channels - 1],
+                     width, height, layers);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                      GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      // grey and grey-alpha images sample as they would from RGB(A)
+      if (channels <= 2) {
+        GLint swizzle[] = {GL_RED, GL_RED, GL_RED,
+                           channels == 2 ? GL_GREEN : GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA,
+                         swizzle);
+      }
+
+      int array = arrays_.size();
+      bool uploaded = false;
+      for (GLsizei layer = 0; layer < layers; ++layer) {
+        size_t image = images[first + layer];
+        entries_[base + image] = {array, GLuint(layer), 0};
+        if (pending_[image].pixels.empty())
+          continue;
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1,
+                        kFormats[channels - 1], GL_UNSIGNED_BYTE,
+                        pending_[image].pixels.data());
+        uploaded = true;
+      }
+      if (uploaded)
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+      // the texture's parameters are frozen from here on
+      GLuint64 handle = 0;
+      if (bindless_) {
+        handle = glGetTextureHandleARB(texture);
+        glMakeTextureHandleResidentARB(handle);
+        for (GLsizei layer = 0; layer < layers; ++layer)
+          entries_[base + images[first + layer]].handle = handle;
+      }
+      arrays_.push_back(texture);
+      formats_.push_back({width, height, channels, compression});
+      handles_.push_back(handle);
+    }
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  spdlog::info("packed {} textures into {} arrays, {} in total{}",
+               pending_.size(), arrays_.size() - first_array, arrays_.size(),
+               bindless_ ? ", bindless" : "");
+  pending_.clear();
+
+  std::vector<GLuint> table(4 * entries_.size());
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry &entry = entries_[i];
+    table[4 * i] = GLuint(entry.handle);
+    table[4 * i + 1] = GLuint(entry.handle >> 32);
+    table[4 * i + 2] = entry.layer;
+    table[4 * i + 3] = entry.array;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, table_);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(GLuint) * table.size(),
+                  table.data());
+}
+
+bool TextureManager::Upload(int index, const void *pixels) {
+  const Entry &entry = entries_[index];
+  size_t size = UploadSize(formats_[entry.array]);
+  size_t needed = size + kStagingAlignment - 1;
+  if (!staging_ || staging_->region_size() < needed) {
+    // grow only between frames, while nothing is staged
+    if (!uploads_.empty())
+      return false;
+    staging_.reset();
+    staging_ = std::make_unique<StreamBuffer>(std::max(kUploadBytes, needed));
+    LabelObject(GL_BUFFER, staging_->buffer(), "texture staging");
+  }
+  if (uploads_.empty())
+    staging_->Begin();
+  if (staging_->available() < needed)
+    return false;
+
+  auto allocation = staging_->Allocate(size, kStagingAlignment);
+  if (!allocation.data)
+    return false;
+  std::memcpy(allocation.data, pixels, size);
+  uploads_.push_back({index, allocation.offset});
+  return true;
+}
+
+size_t TextureManager::FlushUploads() {
+  if (uploads_.empty())
+    return 0;
+  staging_->End();
+
+  // arrays needing new mipmaps; compressed textures bring their own
+  std::vector<int> changed;
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging_->buffer());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (const StagedUpload &upload : uploads_) {
+    const Entry &entry = entries_[upload.index];
+    const Format &format = formats_[entry.array];
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_[entry.array]);
+    if (!format.compression) {
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, entry.layer,
+                      format.width, format.height, 1,
+                      kFormats[format.channels - 1], GL_UNSIGNED_BYTE,
+                      reinterpret_cast<const void *>(upload.offset));
+      changed.push_back(entry.array);
+      continue;
+    }
+    GLintptr offset = upload.offset;
+    int levels = MipLevelCount(format.width, format.height);
+    for (int level = 0; level < levels; ++level) {
+      size_t size =
+          LevelSize(*format.compression, format.width, format.height, level);
+      glCompressedTexSubImage3D(
+          GL_TEXTURE_2D_ARRAY, level, 0, 0, entry.layer,
+          std::max(1, format.width >> level),
+          std::max(1, format.height >> level), 1,
+          CompressedInternalFormat(*format.compression), size,
+          reinterpret_cast<const void *>(offset));
+      offset += size;
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+  for (int array : changed) {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrays_[array]);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  }
+
+  size_t count = uploads_.size();
+  uploads_.clear();
+  return count;
+}
+
+size_t TextureManager::UploadSize(const Format &format) {
+  if (!format.compression)
+    return size_t(format.width) * format.height * format.channels;
+  size_t size = 0;
+  int levels = MipLevelCount(format.width, format.height);
+  for (int level = 0; level < levels; ++level)
+    size += LevelSize(*format.compression, format.width, format.height, level);
+  return size;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "block_compression.h"
+#include "stream_buffer.h"
+
+// Packs images into GL_TEXTURE_2D_ARRAY layers so many textured objects
+// share a few texture objects. Images added between two Updates are grouped
+// by size and channel count, and each group becomes arrays of at most
+// kLayersPerArray layers, allocated at exactly the size needed and with a
+// full mip chain.
+//
+// Shaders find a texture through a table in a uniform buffer, one uvec4
+// per texture, declared as
+//
+//   layout(std140) uniform Textures { uvec4 textures[1024]; };
+//
+// where .xy is the bindless handle of the texture's array, .z its layer and
+// .w the index of its array. With ARB_bindless_texture the handles are
+// resident and a shader samples `sampler2DArray(textures[i].xy)` with no
+// texture bound at all. Without it .xy is zero and the array is bound as
+// usual. Either way every object of an array can be drawn together, picking
+// its layer per instance; handles are only dynamically uniform within an
+// array, so draws are grouped by array in both cases.
+//
+// Pixels can also arrive after their array exists: Reserve a texture of a
+// known size, and once Update has allocated it, Upload its pixels whenever
+// they are ready, then FlushUploads once per frame. Uploads are copied into
+// a StreamBuffer and reach the arrays through GL_PIXEL_UNPACK_BUFFER, so
+// neither the copy nor the transfer waits for the GPU; the stream buffer's
+// fences keep a frame's staging memory from being reused before the GPU
+// has read it. A frame stages at most kUploadBytes, or one image if that is
+// bigger, and Upload declines the rest, which is retried next frame. The
+// layers of a texture are undefined until its pixels are uploaded.
+//
+// Reserved textures can also be block compressed, given as the blocks of
+// every mip level from CompressMipChain. They get arrays of their own,
+// which are uploaded with glCompressedTexSubImage3D and keep the mip chain
+// they were given instead of generating one.
+//
+// Update and FlushUploads bind arrays on the active texture unit, the table
+// to GL_COPY_WRITE_BUFFER and pixel buffers to GL_PIXEL_UNPACK_BUFFER;
+// invalidate a RenderState that tracks them.
+class TextureManager {
+public:
+  static constexpr int kMaxTextures = 1024;
+  static constexpr int kLayersPerArray = 64;
+  static constexpr size_t kUploadBytes = size_t(16) << 20;
+
+  struct Format {
+    int width;
+    int height;
+    // of the pixels, or that the blocks decode to
+    int channels;
+    // empty for uncompressed pixels
+    std::optional<BlockFormat> compression;
+  };
+
+  struct Entry {
+    // index of the array holding the texture, for array()
+    int array;
+    GLuint layer;
+    // 0 without bindless textures
+    GLuint64 handle;
+  };
+
+  // Must be created and destroyed with the GL context current. Bindless
+  // handles are only used when `bindless` is set and the driver has them.
+  explicit TextureManager(bool bindless = true);
+  ~TextureManager();
+
+  TextureManager(const TextureManager &) = delete;
+  TextureManager &operator=(const TextureManager &) = delete;
+
+  // Copies 8-bit pixels with 1 to 4 channels, rows tightly packed, for the
+  // next Update and returns the texture's index in the table, or -1 after
+  // logging the reason.
+  int Add(int width, int height, int channels, const void *pixels);
+  // Like Add, for pixels that are uploaded later.
+  int Reserve(int width, int height, int channels);
+  // Like Reserve, for blocks of `format` that are uploaded later.
+  int Reserve(int width, int height, BlockFormat format);
+
+  // Whether the context can sample `format`. Must be called with the GL
+  // context current.
+  static bool Supports(BlockFormat format);
+
+  // Uploads the textures added since the last Update into new arrays,
+  // generates their mipmaps, makes their handles resident and uploads the
+  // table. Entries are valid from then on.
+  void Update();
+
+  // Stages the pixels of a reserved texture, laid out as for Add, or the
+  // data of its CompressedImage, once Update has allocated it. Returns false
+  // if this frame has no staging memory left for them.
+  bool Upload(int index, const void *pixels);
+  // Transfers the textures staged this frame into their arrays and
+  // regenerates the mipmaps of the uncompressed ones. Returns how many
+  // there were.
+  size_t FlushUploads();
+
+  bool bindless() const { return bindless_; }
+  size_t size() const { return entries_.size() + pending_.size(); }
+  const Entry &entry(int index) const { return entries_[index]; }
+  size_t array_count() const { return arrays_.size(); }
+  GLuint array(int index) const { return arrays_[index]; }
+  const Format &format(int array) const { return formats_[array]; }
+
+  // The uniform buffer holding the table, table_size() bytes long.
+  GLuint table() const { return table_; }
+  static constexpr GLsizeiptr table_size() {
+    return kMaxTextures * 4 * sizeof(GLuint);
+  }
+
+private:
+  struct Image {
+    int width;
+    int height;
+    int channels;
+    std::optional<BlockFormat> compression;
+    // empty for reserved textures
+    std::vector<unsigned char> pixels;
+  };
+
+  struct StagedUpload {
+    int index;
+    GLintptr offset;
+  };
+
+  int Append(int width, int height, int channels,
+             std::optional<BlockFormat> compression);
+  // The bytes Upload takes for a texture of `format`.
+  static size_t UploadSize(const Format &format);
+
+  bool bindless_ = false;
+  GLint max_layers_ = kLayersPerArray;
+  std::vector<GLuint> arrays_;
+  std::vector<Format> formats_;
+  std::vector<GLuint64> handles_;
+  std::vector<Entry> entries_;
+  // added since the last Update, in table order
+  std::vector<Image> pending_;
+  GLuint table_ = 0;
+
+  std::unique_ptr<StreamBuffer> staging_;
+  std::vector<StagedUpload> uploads_;
+};
@@ -1,14 +1,25 @@
-#define GLFW_INCLUDE_NONE
-#include <GLFW/glfw3.h>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <thread>
 #include <vector>
 
+#include "context.h"
+#include "job_system.h"
+#include "program_cache.h"
+#include "render_queue.h"
+#include "render_state.h"
+#include "stream_buffer.h"
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 const int WINDOW_WIDTH = 600;
@@ -54,6 +65,21 @@ void main() {
 }
 )##";
 
+// Instanced mode: each instance's MVP is a vertex attribute with divisor 1,
+// occupying locations 2 to 5.
+const char *instanced_vertex_shader_source = u8R"##(#version 400
+layout(location = 0) in vec3 vertex_position;
+layout(location = 1) in vec3 vertex_color;
+layout(location = 2) in mat4 instance_mvp;
+
+out vec3 color;
+
+void main() {
+  color = vertex_color;
+  gl_Position = instance_mvp * vec4(vertex_position, 1.0);
+}
+)##";
+
 const char *fragment_shader_source = u8R"##(#version 400
 in vec3 color;
 out vec4 frag_color;
@@ -63,62 +89,293 @@ void main() {
 }
 )##";
 
-void HandleGLFWError(int error, const char *description) {
-  spdlog::error("GLFW Error: {}", description);
+// cubes are 2 units wide and laid out on a grid with 1 unit gaps
+const float CUBE_SPACING = 3.0f;
+const int MAX_CUBES = 1 << 20;
+// cubes per job when updating transforms in parallel
+const size_t TRANSFORM_GRAIN = 1024;
+
+// frames rendered per mode and cube count by --sweep, after a short warm-up
+const int SWEEP_FRAMES = 30;
+const int SWEEP_WARMUP_FRAMES = 5;
+
+enum DrawMode {
+  // one glDrawElements per cube, with its MVP in a uniform
+  PER_CUBE,
+  // one instanced draw, with the MVPs in an instance attribute
+  INSTANCED,
+  // every cube its own item of the render queue, sorted front to back and
+  // merged back into multi-draws
+  QUEUED,
+  DRAW_MODE_COUNT
+};
+const char *DRAW_MODE_NAMES[] = {"one draw per cube", "instanced", "queued"};
+
+int cube_count = 1;
+// M cycles through the draw modes
+DrawMode draw_mode = INSTANCED;
+
+void HandleKeyEvents(GLFWwindow *window, int key, int scancode, int action,
+                     int mods) {
+  if (action != GLFW_PRESS)
+    return;
+  switch (key) {
+  case GLFW_KEY_UP:
+    cube_count = std::min(cube_count * 10, MAX_CUBES);
+    break;
+  case GLFW_KEY_DOWN:
+    cube_count = std::max(cube_count / 10, 1);
+    break;
+  case GLFW_KEY_M:
+    draw_mode = DrawMode((draw_mode + 1) % DRAW_MODE_COUNT);
+    break;
+  default:
+    return;
+  }
+  spdlog::info("{} cubes, {}", cube_count, DRAW_MODE_NAMES[draw_mode]);
 }
 
-void LogShaderInfo(GLuint shader_id) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char buffer[2048];
-  glGetShaderInfoLog(shader_id, max_length, &actual_length, buffer);
-  spdlog::error("shader info log for GL index {}:\n{}", shader_id, buffer);
+// Cubes per side of the smallest grid holding `count` cubes.
+int GridSide(int count) {
+  int side = std::max(1, (int)std::ceil(std::cbrt((double)count)));
+  while (side * side * side < count)
+    ++side;
+  return side;
 }
 
-void LogProgramInfo(GLuint program) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char program_log[2048];
-  glGetProgramInfoLog(program, max_length, &actual_length, program_log);
-  spdlog::error("program info log for GL index {}:\n{}", program, program_log);
+struct Scene {
+  GLuint program;
+  GLuint instanced_program;
+  GLuint uniform_mvp;
+  GLuint vao;
+  GLuint instanced_vao;
+  float aspect_ratio;
+  // grid positions of the cubes being drawn
+  std::vector<glm::vec3> positions;
+  // per-cube MVPs of the one draw per cube mode
+  std::vector<glm::mat4> transforms;
+  // per-cube distances from the camera, for sorting queued cubes
+  std::vector<float> depths;
+  std::unique_ptr<StreamBuffer> instances;
+  // updates the transforms so this thread only has to issue GL calls
+  JobSystem *jobs;
+  RenderState *state;
+  RenderQueue *queue;
+};
+
+void LayOut(Scene &scene, int count) {
+  int side = GridSide(count);
+  float center = (side - 1) * 0.5f;
+  scene.positions.resize(count);
+  for (int i = 0; i < count; ++i)
+    scene.positions[i] =
+        CUBE_SPACING * (glm::vec3(i % side, i / side % side,
+                                  i / (side * side)) -
+                        glm::vec3(center));
 }
 
-int main() {
-  glfwSetErrorCallback(HandleGLFWError);
+float FarPlane(int count) { return 100.0f * GridSide(count); }
 
-  // start GL context and O/S window using the GLFW helper library
-  if (!glfwInit()) {
-    spdlog::error("could not start GLFW3");
-    return 1;
-  }
+// Pulls the camera back far enough to see a grid of `count` cubes.
+glm::mat4 ViewProjection(const Scene &scene, int count) {
+  float side = GridSide(count);
+  glm::vec3 camera_position = glm::vec3(3.0f, 2.0f, 2.0f) * side;
+  glm::vec3 camera_target(0.0f, 0.0f, 0.0f);
+  glm::vec3 up_vector(0.0f, 1.0f, 0.0f);
+  glm::mat4 view = glm::lookAt(camera_position, camera_target, up_vector);
+  glm::mat4 projection = glm::perspective(
+      glm::radians(45.0f), scene.aspect_ratio, 0.1f, FarPlane(count));
+  return projection * view;
+}
 
-  // Anti-Aliasing
-  glfwWindowHint(GLFW_SAMPLES, 4);
+// Writes the MVP of each of the first `count` cubes; they spin about their
+// own y axis, out of phase with each other. With `depths`, also writes how
+// far along the view each cube is, from 0 at the camera to 1 at the far
+// plane. Chunks of cubes are spread over the job system.
+void UpdateTransforms(const Scene &scene, int count, double time,
+                      glm::mat4 *transforms, float *depths = nullptr) {
+  float angular_velocity = glm::pi<float>() * 0.1f;
+  glm::mat4 view_projection = ViewProjection(scene, count);
+  float far_plane = FarPlane(count);
+  scene.jobs->ParallelFor(count, TRANSFORM_GRAIN, [&](size_t begin,
+                                                      size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      float angle = angular_velocity * time + 0.1f * i;
+      glm::mat4 mvp = view_projection * glm::translate(scene.positions[i]) *
+                      glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
+      transforms[i] = mvp;
+      // the clip w of the cube's center is its view depth
+      if (depths)
+        depths[i] = mvp[3][3] / far_plane;
+    }
+  });
+}
 
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+void DrawFrame(Scene &scene, FrameProfiler &profiler, int count,
+               DrawMode mode, double time) {
+  if ((int)scene.positions.size() != count)
+    LayOut(scene, count);
+
+  profiler.Begin("update");
+  RenderState &state = *scene.state;
+  bool per_instance = mode != PER_CUBE;
+  size_t bytes = sizeof(glm::mat4) * count;
+  if (per_instance &&
+      (!scene.instances || scene.instances->region_size() < bytes)) {
+    // the new buffer may reuse the old name, so forget the old binding
+    state.BindBuffer(GL_ARRAY_BUFFER, 0);
+    scene.instances = std::make_unique<StreamBuffer>(bytes);
+    LabelObject(GL_BUFFER, scene.instances->buffer(), "cube instances");
+    state.BindVertexArray(scene.instanced_vao);
+    state.BindBuffer(GL_ARRAY_BUFFER, scene.instances->buffer());
+    for (int column = 0; column < 4; ++column) {
+      glEnableVertexAttribArray(2 + column);
+      glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE,
+                            sizeof(glm::mat4),
+                            BUFFER_OFFSET(sizeof(glm::vec4) * column));
+      glVertexAttribDivisor(2 + column, 1);
+    }
+  }
+
+  StreamBuffer::Allocation allocation;
+  if (per_instance) {
+    // transforms go straight into memory the GPU reads
+    float *depths = nullptr;
+    if (mode == QUEUED) {
+      scene.depths.resize(count);
+      depths = scene.depths.data();
+    }
+    scene.instances->Begin();
+    allocation = scene.instances->Allocate(bytes, sizeof(glm::mat4));
+    if (allocation.data)
+      UpdateTransforms(scene, count, time,
+                       static_cast<glm::mat4 *>(allocation.data), depths);
+    scene.instances->End();
+  } else {
+    scene.transforms.resize(count);
+    UpdateTransforms(scene, count, time, scene.transforms.data());
+  }
 
-  GLFWwindow *window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT,
-                                        "Hello Triangle", NULL, NULL);
+  // wipe the drawing surface clear
+  profiler.Begin("clear");
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  profiler.Begin("draw");
+  // the attributes point at the start of the buffer; the base instance
+  // selects this frame's region of it
+  GLuint base_instance = allocation.offset / sizeof(glm::mat4);
+  if (mode == INSTANCED) {
+    if (!allocation.data)
+      return;
+    state.UseProgram(scene.instanced_program);
+    state.BindVertexArray(scene.instanced_vao);
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, indices.size(),
+                                        GL_UNSIGNED_SHORT, 0, count,
+                                        base_instance);
+  } else if (mode == QUEUED) {
+    if (!allocation.data)
+      return;
+    RenderQueue::Item item;
+    item.program = scene.instanced_program;
+    item.vao = scene.instanced_vao;
+    item.index_type = GL_UNSIGNED_SHORT;
+    item.count = indices.size();
+    for (int i = 0; i < count; ++i) {
+      item.base_instance = base_instance + i;
+      scene.queue->Submit(item, scene.depths[i]);
+    }
+    scene.queue->Flush(state);
+  } else {
+    state.UseProgram(scene.program);
+    state.BindVertexArray(scene.vao);
+    for (int i = 0; i < count; ++i) {
+      glUniformMatrix4fv(scene.uniform_mvp, 1, GL_FALSE,
+                         &scene.transforms[i][0][0]);
+      glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT, 0);
+    }
+  }
+}
 
-  if (!window) {
-    spdlog::error("could not open window with GLFW3");
-    glfwTerminate();
-    return 1;
+// Renders every cube count from 1 to 100000 in each mode and logs the frame
+// time along with the CPU time spent updating and submitting draws, which
+// is what instancing and the render queue save.
+void Sweep(Context &context, Scene &scene) {
+  using Clock = std::chrono::steady_clock;
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+  spdlog::info("{:>7} {:>17} {:>17} {:>17} {:>9} {:>9}", "cubes",
+               "per cube", "instanced", "queued", "instanced", "queued");
+  spdlog::info("{:>7} {:>17} {:>17} {:>17} {:>9} {:>9}", "",
+               "frame / submit", "frame / submit", "frame / submit",
+               "speedup", "speedup");
+  for (int count = 1; count <= 100000; count *= 10) {
+    double frame_ms[DRAW_MODE_COUNT], submit_ms[DRAW_MODE_COUNT];
+    for (int mode = 0; mode < DRAW_MODE_COUNT; ++mode) {
+      for (int frame = 0; frame < SWEEP_WARMUP_FRAMES; ++frame) {
+        DrawFrame(scene, context.profiler(), count, DrawMode(mode),
+                  context.Time());
+        context.EndFrame();
+      }
+      glFinish();
+      Milliseconds submit{};
+      auto start = Clock::now();
+      for (int frame = 0; frame < SWEEP_FRAMES; ++frame) {
+        auto submit_start = Clock::now();
+        DrawFrame(scene, context.profiler(), count, DrawMode(mode),
+                  context.Time());
+        submit += Clock::now() - submit_start;
+        context.EndFrame();
+      }
+      glFinish();
+      Milliseconds elapsed = Clock::now() - start;
+      frame_ms[mode] = elapsed.count() / SWEEP_FRAMES;
+      submit_ms[mode] = submit.count() / SWEEP_FRAMES;
+    }
+    spdlog::info("{:>7} {:>8.3f} {:>8.3f} {:>8.3f} {:>8.3f} {:>8.3f} {:>8.3f} "
+                 "{:>8.1f}x {:>8.1f}x",
+                 count, frame_ms[PER_CUBE], submit_ms[PER_CUBE],
+                 frame_ms[INSTANCED], submit_ms[INSTANCED], frame_ms[QUEUED],
+                 submit_ms[QUEUED], frame_ms[PER_CUBE] / frame_ms[INSTANCED],
+                 frame_ms[PER_CUBE] / frame_ms[QUEUED]);
   }
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1); // Enable vsync
+  spdlog::info("times are ms/frame; the queue drew with {} GL calls",
+               scene.queue->last_draw_calls());
+}
 
-  if (!gladLoadGL()) {
-    spdlog::error("failed to initialize OpenGL loader");
+int main(int argc, char **argv) {
+  ContextOptions options;
+  options.width = WINDOW_WIDTH;
+  options.height = WINDOW_HEIGHT;
+  if (!ParseContextOptions(argc, argv, options))
     return 1;
+
+  bool sweep = false;
+  int threads = std::thread::hardware_concurrency();
+  for (int i = 1; i < argc; ++i) {
+    if (std::sscanf(argv[i], "--cubes=%d", &cube_count) == 1 &&
+        cube_count > 0 && cube_count <= MAX_CUBES) {
+      continue;
+    } else if (std::sscanf(argv[i], "--threads=%d", &threads) == 1 &&
+               threads > 0) {
+      continue;
+    } else if (std::strcmp(argv[i], "--naive") == 0) {
+      draw_mode = PER_CUBE;
+    } else if (std::strcmp(argv[i], "--queued") == 0) {
+      draw_mode = QUEUED;
+    } else if (std::strcmp(argv[i], "--sweep") == 0) {
+      sweep = true;
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--headless] [--size=WxH] [--frames=N] [--cubes=N] "
+                   "[--naive | --queued] [--sweep] [--threads=N]"
+                << std::endl;
+      return 1;
+    }
   }
 
-  // get version info
-  spdlog::info("Renderer: {}", glGetString(GL_RENDERER));
-  spdlog::info("OpenGL version supported: {}", glGetString(GL_VERSION));
+  auto context = Context::Create(options, "Hello Triangle");
+  if (!context)
+    return 1;
+  context->SetKeyCallback(HandleKeyEvents);
 
   // tell GL to only draw onto a pixel if the shape is closer to the viewer
   glEnable(GL_DEPTH_TEST); // enable depth-testing
@@ -139,98 +396,61 @@ int main() {
   glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0],
                GL_STATIC_DRAW);
 
-  GLuint vao = 0;
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 24, BUFFER_OFFSET(0));
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 24, BUFFER_OFFSET(12));
-
   GLuint ebo;
   glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(),
-               &indices[0], GL_STATIC_DRAW);
 
-  int params = -1;
-  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader);
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", vertex_shader);
-    LogShaderInfo(vertex_shader);
-    return 1; // or exit or something
+  // the instanced VAO shares the cube's buffers and adds the per-instance
+  // transforms once their buffer exists
+  JobSystem jobs(threads);
+  RenderQueue queue;
+  Scene scene;
+  scene.jobs = &jobs;
+  scene.state = &context->state();
+  scene.queue = &queue;
+  for (GLuint *vao : {&scene.vao, &scene.instanced_vao}) {
+    glGenVertexArrays(1, vao);
+    glBindVertexArray(*vao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 24, BUFFER_OFFSET(0));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 24, BUFFER_OFFSET(12));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
   }
-
-  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", fragment_shader);
-    LogShaderInfo(fragment_shader);
-    return 1; // or exit or something
-  }
-
-  GLuint program = glCreateProgram();
-  glAttachShader(program, fragment_shader);
-  glAttachShader(program, vertex_shader);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("could not link shader program GL index {}", program);
-    LogProgramInfo(program);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(),
+               &indices[0], GL_STATIC_DRAW);
+  LabelObject(GL_BUFFER, vbo, "cube vertices");
+  LabelObject(GL_BUFFER, ebo, "cube indices");
+
+  ProgramCache programs;
+  scene.program =
+      programs.Get({{GL_VERTEX_SHADER, vertex_shader_source},
+                    {GL_FRAGMENT_SHADER, fragment_shader_source}});
+  scene.instanced_program =
+      programs.Get({{GL_VERTEX_SHADER, instanced_vertex_shader_source},
+                    {GL_FRAGMENT_SHADER, fragment_shader_source}});
+  if (!scene.program || !scene.instanced_program)
     return 1;
-  }
+  LabelObject(GL_PROGRAM, scene.program, "cube");
+  LabelObject(GL_PROGRAM, scene.instanced_program, "instanced cube");
 
-  GLuint uniform_mvp = glGetUniformLocation(program, "MVP");
-  GLuint uniform_texture = glGetUniformLocation(program, "texture0");
+  scene.uniform_mvp = glGetUniformLocation(scene.program, "MVP");
 
-  glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-  float aspect_ratio = WINDOW_WIDTH / (float)WINDOW_HEIGHT;
-  glm::vec3 camera_position(3.0f, 2.0f, 2.0f);
-  glm::vec3 camera_target(0.0f, 0.0f, 0.0f);
-  glm::vec3 up_vector(0.0f, 1.0f, 0.0f);
-  glm::mat4 view = glm::lookAt(camera_position, camera_target, up_vector);
-  glm::mat4 projection = glm::perspective(
-      glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f,
-      100.0f);
-  float angular_velocity = glm::pi<float>() * 0.1f;
+  glViewport(0, 0, options.width, options.height);
+  scene.aspect_ratio = options.width / (float)options.height;
 
-  while (!glfwWindowShouldClose(window)) {
-    double time = glfwGetTime();
-    float angle = angular_velocity * time;
-    auto model = glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
-    auto mvp = projection * view * model;
-
-    // wipe the drawing surface clear
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(program);
-    glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, &mvp[0][0]);
-
-    glBindVertexArray(vao);
-    // draw points 0-3 from the currently bound VAO with current in-use shader
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT, 0);
-    // put the stuff we've been drawing onto the display
-    glfwSwapBuffers(window);
-    // update other events like input handling
-    glfwPollEvents();
-
-    if (GLFW_PRESS == glfwGetKey(window, GLFW_KEY_ESCAPE)) {
-      glfwSetWindowShouldClose(window, 1);
-    }
+  if (sweep) {
+    Sweep(*context, scene);
+    return 0;
   }
 
-  glDetachShader(program, vertex_shader);
-  glDetachShader(program, fragment_shader);
-
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+  spdlog::info("{} cubes, {}, {} threads", cube_count,
+               DRAW_MODE_NAMES[draw_mode], jobs.size());
+  while (!context->ShouldClose()) {
+    DrawFrame(scene, context->profiler(), cube_count, draw_mode,
+              context->Time());
+    context->EndFrame();
+  }
 
-  // close GL context and any other GLFW resources
-  glfwTerminate();
   return 0;
 }
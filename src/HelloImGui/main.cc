@@ -3,10 +3,7 @@
 #include <imgui_impl_opengl3.h>
 #include <stdio.h>
 
-#include <glad/glad.h> // Initialize with gladLoadGL()
-
-// Include glfw3.h after our OpenGL definitions
-#include <GLFW/glfw3.h>
+#include "context.h"
 
 // [Win32] Our example includes a copy of glfw3.lib pre-compiled with VS2010 to
 // maximize ease of testing and compatibility with old VS compilers. To link
@@ -19,35 +16,20 @@
 #pragma comment(lib, "legacy_stdio_definitions")
 #endif
 
-static void glfw_error_callback(int error, const char *description) {
-  fprintf(stderr, "Glfw Error %d: %s\n", error, description);
-}
-
-int main(int, char **) {
+int main(int argc, char **argv) {
   // Setup window
-  glfwSetErrorCallback(glfw_error_callback);
-  if (!glfwInit())
+  ContextOptions options;
+  options.width = 1280;
+  options.height = 720;
+  if (!ParseContextOptions(argc, argv, options))
     return 1;
 
   const char *glsl_version = "#version 430";
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  // glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);  // 3.2+
-  // only glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // 3.0+ only
-
-  // Create window with graphics context
-  GLFWwindow *window = glfwCreateWindow(
-      1280, 720, "Dear ImGui GLFW+OpenGL3 example", NULL, NULL);
-  if (window == NULL)
-    return 1;
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1); // Enable vsync
-
-  bool err = gladLoadGL() == 0;
-  if (err) {
-    fprintf(stderr, "Failed to initialize OpenGL loader!\n");
+  auto context =
+      Context::Create(options, "Dear ImGui GLFW+OpenGL3 example", 4, 3);
+  if (!context)
     return 1;
-  }
+  GLFWwindow *window = context->window();
 
   // Setup Dear ImGui context
   IMGUI_CHECKVERSION();
@@ -62,8 +44,10 @@ int main(int, char **) {
   ImGui::StyleColorsDark();
   // ImGui::StyleColorsClassic();
 
-  // Setup Platform/Renderer backends
-  ImGui_ImplGlfw_InitForOpenGL(window, true);
+  // Setup Platform/Renderer backends. Headless runs have no window, so the
+  // display size and frame time are set by hand instead.
+  if (window)
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
   ImGui_ImplOpenGL3_Init(glsl_version);
 
   // Load Fonts
@@ -96,7 +80,7 @@ int main(int, char **) {
   ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
   // Main loop
-  while (!glfwWindowShouldClose(window)) {
+  while (!context->ShouldClose()) {
     // Poll and handle events (inputs, window resize, etc.)
     // You can read the io.WantCaptureMouse, io.WantCaptureKeyboard flags to
     // tell if dear imgui wants to use your inputs.
@@ -105,12 +89,17 @@ int main(int, char **) {
     // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input
     // data to your main application. Generally you may always pass all inputs
     // to dear imgui, and hide them from your application based on those two
-    // flags.
-    glfwPollEvents();
+    // flags. Context::EndFrame polls them after each frame, or waits for them
+    // when drawing on demand.
 
     // Start the Dear ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
+    if (window) {
+      ImGui_ImplGlfw_NewFrame();
+    } else {
+      io.DisplaySize = ImVec2((float)options.width, (float)options.height);
+      io.DeltaTime = 1.0f / 60.0f;
+    }
     ImGui::NewFrame();
 
     // 1. Show the big demo window (Most of the sample code is in
@@ -167,24 +156,24 @@ int main(int, char **) {
 
     // Rendering
     ImGui::Render();
-    int display_w, display_h;
-    glfwGetFramebufferSize(window, &display_w, &display_h);
-    glViewport(0, 0, display_w, display_h);
+    // drawn on demand, frames only follow events, but the text cursor
+    // blinks while a text field has focus
+    if (io.WantTextInput)
+      context->RequestRedraw(0.4);
+    glViewport(0, 0, context->width(), context->height());
     glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w,
                  clear_color.z * clear_color.w, clear_color.w);
     glClear(GL_COLOR_BUFFER_BIT);
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-    glfwSwapBuffers(window);
+    context->EndFrame();
   }
 
   // Cleanup
   ImGui_ImplOpenGL3_Shutdown();
-  ImGui_ImplGlfw_Shutdown();
+  if (window)
+    ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
-
   return 0;
 }
@@ -0,0 +1,318 @@
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <thread>
+
+#include "icosphere.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+
+// Count every heap allocation so the benchmark can report them per mesh.
+static size_t allocation_count = 0;
+
+void *operator new(size_t size) {
+  ++allocation_count;
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+// The std::map based subdivision the edge table replaced, kept as a baseline.
+namespace reference {
+template <typename Index>
+using Lookup = std::map<std::pair<Index, Index>, Index>;
+
+template <typename Index>
+Index VertexForEdge(Lookup<Index> &lookup, VertexList &vertices, Index first,
+                    Index second) {
+  typename Lookup<Index>::key_type key(first, second);
+  if (key.first > key.second)
+    std::swap(key.first, key.second);
+
+  auto [it, inserted] =
+      lookup.insert({key, static_cast<Index>(vertices.size())});
+  if (inserted) {
+    auto &edge0 = vertices[first];
+    auto &edge1 = vertices[second];
+    auto point = normalize(edge0 + edge1);
+    vertices.push_back(point);
+  }
+
+  return it->second;
+}
+
+template <typename Index>
+TriangleList<Index> Subdivide(VertexList &vertices,
+                              TriangleList<Index> triangles) {
+  Lookup<Index> lookup;
+  TriangleList<Index> result;
+
+  for (auto &&each : triangles) {
+    std::array<Index, 3> mid;
+    for (int edge = 0; edge < 3; ++edge) {
+      mid[edge] = VertexForEdge(lookup, vertices, each.vertices[edge],
+                                each.vertices[(edge + 1) % 3]);
+    }
+
+    result.push_back({each.vertices[0], mid[0], mid[2]});
+    result.push_back({each.vertices[1], mid[1], mid[0]});
+    result.push_back({each.vertices[2], mid[2], mid[1]});
+    result.push_back({mid[0], mid[1], mid[2]});
+  }
+
+  return result;
+}
+
+template <typename Index>
+icosahedron::IndexedMesh<Index> MakeIcosphere(int subdivisions) {
+  auto mesh = icosahedron::MakeIcosahedron<Index>();
+
+  for (int i = 0; i < subdivisions; ++i) {
+    mesh.second = Subdivide(mesh.first, mesh.second);
+  }
+
+  return mesh;
+}
+} // namespace reference
+
+struct Sample {
+  double milliseconds;
+  size_t allocations;
+};
+
+// Runs `make` repeatedly for at least `budget` seconds and reports the mean
+// time and the allocations of a single run.
+template <typename F> Sample Measure(F make, double budget = 0.25) {
+  using Clock = std::chrono::steady_clock;
+
+  size_t before = allocation_count;
+  make();
+  size_t allocations = allocation_count - before;
+
+  int runs = 0;
+  auto start = Clock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    make();
+    ++runs;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < budget);
+
+  return {elapsed.count() * 1000.0 / runs, allocations};
+}
+
+// Reads one byte per page so a mapped mesh is actually faulted in.
+size_t TouchPages(const void *data, size_t size) {
+  const size_t page = 4096;
+  auto *bytes = static_cast<const unsigned char *>(data);
+  size_t sum = 0;
+  for (size_t offset = 0; offset < size; offset += page)
+    sum += bytes[offset];
+  return sum;
+}
+
+template <typename Index>
+bool Identical(const icosahedron::IndexedMesh<Index> &a,
+               const icosahedron::IndexedMesh<Index> &b) {
+  return a.first == b.first && a.second.size() == b.second.size() &&
+         std::memcmp(a.second.data(), b.second.data(),
+                     sizeof(Triangle<Index>) * a.second.size()) == 0;
+}
+
+// What the cache does on a miss: generate the level, then optimize it.
+template <typename Index>
+icosahedron::IndexedMesh<Index> BuildIcosphere(int level) {
+  LineList<Index> lines;
+  auto mesh = icosahedron::GenerateIcosphere<Index>(level);
+  OptimizeMesh(mesh.first, mesh.second, &lines);
+  return mesh;
+}
+
+int main(int argc, char **argv) {
+  const int max_level = 8;
+  const int min_parallel_level = 5;
+  unsigned max_threads = argc > 1 ? std::atoi(argv[1])
+                                  : std::thread::hardware_concurrency();
+  max_threads = std::max(max_threads, 1u);
+
+  spdlog::info("{:>5} {:>9} {:>11} {:>12} {:>11} {:>12} {:>8}", "level",
+               "vertices", "map ms", "map allocs", "table ms", "table allocs",
+               "speedup");
+  for (int level = 0; level <= max_level; ++level) {
+    icosahedron::VisitIndexType(level, [level](auto type) {
+      using Index = typename decltype(type)::type;
+      auto before =
+          Measure([level] { return reference::MakeIcosphere<Index>(level); });
+      auto after =
+          Measure([level] { return icosahedron::MakeIcosphere<Index>(level); });
+      spdlog::info("{:>5} {:>9} {:>11.3f} {:>12} {:>11.3f} {:>12} {:>7.2f}x",
+                   level, icosahedron::VertexCount(level), before.milliseconds,
+                   before.allocations, after.milliseconds, after.allocations,
+                   before.milliseconds / after.milliseconds);
+    });
+  }
+
+  spdlog::info("{:>5} {:>9} {:>12} {:>15} {:>11} {:>13} {:>8}", "level",
+               "triangles", "subdivide ms", "subdivide allocs", "direct ms",
+               "direct allocs", "speedup");
+  for (int level = 0; level <= max_level; ++level) {
+    icosahedron::VisitIndexType(level, [level](auto type) {
+      using Index = typename decltype(type)::type;
+      auto before =
+          Measure([level] { return icosahedron::MakeIcosphere<Index>(level); });
+      auto after = Measure(
+          [level] { return icosahedron::GenerateIcosphere<Index>(level); });
+      spdlog::info("{:>5} {:>9} {:>12.3f} {:>15} {:>11.3f} {:>13} {:>7.2f}x",
+                   level, icosahedron::TriangleCount(level),
+                   before.milliseconds, before.allocations, after.milliseconds,
+                   after.allocations, before.milliseconds / after.milliseconds);
+    });
+  }
+
+  spdlog::info("{:>9} {:>15} {:>15} {:>8}", "midpoints", "scalar Mvert/s",
+               "simd Mvert/s", "speedup");
+  for (size_t count : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20}) {
+    std::vector<float> x(count), y(count), z(count);
+    for (size_t i = 0; i < count; ++i) {
+      x[i] = 1.0f + i % 7;
+      y[i] = 2.0f - i % 5;
+      z[i] = 0.5f + i % 3;
+    }
+    auto scalar = Measure(
+        [&] { NormalizeScalar(x.data(), y.data(), z.data(), count); });
+    auto simd =
+        Measure([&] { Normalize(x.data(), y.data(), z.data(), count); });
+    spdlog::info("{:>9} {:>15.1f} {:>15.1f} {:>7.2f}x", count,
+                 count / scalar.milliseconds / 1000.0,
+                 count / simd.milliseconds / 1000.0,
+                 scalar.milliseconds / simd.milliseconds);
+  }
+
+  spdlog::info("{:>5} {:>9} {:>15} {:>16} {:>8} {:>9}", "level", "vertices",
+               "scalar Mvert/s", "batched Mvert/s", "speedup", "identical");
+  for (int level = 1; level <= max_level; ++level) {
+    icosahedron::VisitIndexType(level, [level](auto type) {
+      using Index = typename decltype(type)::type;
+      auto make = [level](icosahedron::Normalization normalization) {
+        return icosahedron::MakeIcosphere<Index>(level, normalization);
+      };
+      bool identical = Identical(make(icosahedron::Normalization::kScalar),
+                                 make(icosahedron::Normalization::kBatched));
+      auto scalar =
+          Measure([&] { return make(icosahedron::Normalization::kScalar); });
+      auto batched =
+          Measure([&] { return make(icosahedron::Normalization::kBatched); });
+      size_t vertices = icosahedron::VertexCount(level);
+      spdlog::info("{:>5} {:>9} {:>15.2f} {:>16.2f} {:>7.2f}x {:>9}", level,
+                   vertices, vertices / scalar.milliseconds / 1000.0,
+                   vertices / batched.milliseconds / 1000.0,
+                   scalar.milliseconds / batched.milliseconds,
+                   identical ? "yes" : "NO");
+    });
+  }
+
+  spdlog::info("{:>5} {:>9} {:>13} {:>11} {:>13} {:>8} {:>8}", "level",
+               "order", "optimize ms", "ACMR", "ATVR", "ACMR x", "ATVR x");
+  for (int level = 0; level <= max_level; ++level) {
+    icosahedron::VisitIndexType(level, [level](auto type) {
+      using Index = typename decltype(type)::type;
+      auto log = [level](const char *order, double milliseconds,
+                         VertexCacheStatistics stats,
+                         VertexCacheStatistics baseline) {
+        spdlog::info("{:>5} {:>9} {:>13.3f} {:>11.3f} {:>13.3f} {:>7.2f}x "
+                     "{:>7.2f}x",
+                     level, order, milliseconds, stats.acmr, stats.atvr,
+                     baseline.acmr / stats.acmr, baseline.atvr / stats.atvr);
+      };
+      auto subdivided = icosahedron::MakeIcosphere<Index>(level);
+      auto baseline =
+          AnalyzeVertexCache(subdivided.second, subdivided.first.size());
+      log("subdivide", 0.0, baseline, baseline);
+
+      auto direct = icosahedron::GenerateIcosphere<Index>(level);
+      log("direct", 0.0,
+          AnalyzeVertexCache(direct.second, direct.first.size()), baseline);
+
+      auto optimize = Measure([&direct] {
+        auto mesh = direct;
+        OptimizeMesh(mesh.first, mesh.second);
+        return mesh;
+      });
+      OptimizeMesh(direct.first, direct.second);
+      log("optimized", optimize.milliseconds,
+          AnalyzeVertexCache(direct.second, direct.first.size()), baseline);
+    });
+  }
+
+  spdlog::info("{:>5} {:>7} {:>11} {:>8} {:>9}", "level", "threads", "ms",
+               "speedup", "identical");
+  for (int level = min_parallel_level; level <= max_level; ++level) {
+    icosahedron::VisitIndexType(level, [level, max_threads](auto type) {
+      using Index = typename decltype(type)::type;
+      auto serial = icosahedron::MakeIcosphere<Index>(level);
+      auto baseline =
+          Measure([level] { return icosahedron::MakeIcosphere<Index>(level); });
+      spdlog::info("{:>5} {:>7} {:>11.3f} {:>7.2f}x {:>9}", level, "serial",
+                   baseline.milliseconds, 1.0, "yes");
+
+      for (unsigned threads = 1; threads <= max_threads; ++threads) {
+        ThreadPool pool(threads);
+        auto make = [&pool, level] {
+          return icosahedron::MakeIcosphere<Index>(pool, level);
+        };
+        bool identical = Identical(serial, make());
+        auto sample = Measure(make);
+        spdlog::info("{:>5} {:>7} {:>11.3f} {:>7.2f}x {:>9}", level, threads,
+                     sample.milliseconds,
+                     baseline.milliseconds / sample.milliseconds,
+                     identical ? "yes" : "NO");
+      }
+    });
+  }
+
+  const char *cache_path = "IcosphereBench.cache";
+  {
+    ThreadPool pool(1);
+    IcosphereCache cache(cache_path);
+    for (int level = 0; level <= max_level; ++level)
+      cache.Get(pool, level);
+    cache.Save();
+  }
+
+  spdlog::info("{:>5} {:>11} {:>11} {:>8}", "level", "build ms",
+               "mapped ms", "speedup");
+  for (int level = 0; level <= max_level; ++level) {
+    icosahedron::VisitIndexType(level, [level, cache_path](auto type) {
+      using Index = typename decltype(type)::type;
+      auto generate = Measure([level] { return BuildIcosphere<Index>(level); });
+
+      auto log_level = spdlog::get_level();
+      spdlog::set_level(spdlog::level::warn);
+      ThreadPool pool(1);
+      auto mapped = Measure([&] {
+        IcosphereCache cache(cache_path);
+        MeshView mesh = cache.Get(pool, level);
+        return TouchPages(mesh.vertices, sizeof(Vertex) * mesh.vertex_count) +
+               TouchPages(mesh.indices,
+                          mesh.index_size * 3 * mesh.triangle_count);
+      });
+      spdlog::set_level(log_level);
+
+      spdlog::info("{:>5} {:>11.3f} {:>11.3f} {:>7.1f}x", level,
+                   generate.milliseconds, mapped.milliseconds,
+                   generate.milliseconds / mapped.milliseconds);
+    });
+  }
+  std::remove(cache_path);
+
+  return 0;
+}
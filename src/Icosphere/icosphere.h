@@ -0,0 +1,605 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "midpoint_batch.h"
+#include "thread_pool.h"
+
+using Vertex = glm::vec3;
+
+template <typename Index> struct Triangle {
+  Index vertices[3];
+};
+
+template <typename Index> struct Line {
+  Index vertices[2];
+};
+
+template <typename Index> using TriangleList = std::vector<Triangle<Index>>;
+template <typename Index> using LineList = std::vector<Line<Index>>;
+using VertexList = std::vector<Vertex>;
+
+// https://schneide.blog/2016/07/15/generating-an-icosphere-in-c/
+namespace icosahedron {
+const float X = .525731112119133606f;
+const float Z = .850650808352039932f;
+const float N = 0.f;
+
+inline const VertexList vertices = {
+    {-X, N, Z}, {X, N, Z},   {-X, N, -Z}, {X, N, -Z}, {N, Z, X},  {N, Z, -X},
+    {N, -Z, X}, {N, -Z, -X}, {Z, X, N},   {-Z, X, N}, {Z, -X, N}, {-Z, -X, N}};
+
+inline const TriangleList<uint16_t> triangles = {
+    {0, 4, 1},  {0, 9, 4},  {9, 5, 4},  {4, 5, 8},  {4, 8, 1},
+    {8, 10, 1}, {8, 3, 10}, {5, 3, 8},  {5, 2, 3},  {2, 7, 3},
+    {7, 10, 3}, {7, 6, 10}, {7, 11, 6}, {11, 0, 6}, {0, 1, 6},
+    {6, 1, 10}, {9, 0, 11}, {9, 11, 2}, {9, 2, 5},  {7, 2, 11}};
+
+// The most subdivisions the demos ask for: 2.6 million vertices, 5.2
+// million triangles. Every level past it quadruples the memory, and from
+// level 15 on the vertices no longer fit 32-bit indices.
+constexpr int kMaxLevel = 9;
+
+// Number of vertices, triangles and unique edges of a sphere subdivided
+// `subdivisions` times. Each pass splits every triangle into four and adds
+// one vertex per edge.
+constexpr size_t VertexCount(int subdivisions) {
+  return 10 * (size_t(1) << (2 * subdivisions)) + 2;
+}
+
+constexpr size_t TriangleCount(int subdivisions) {
+  return 20 * (size_t(1) << (2 * subdivisions));
+}
+
+constexpr size_t EdgeCount(int subdivisions) {
+  return 30 * (size_t(1) << (2 * subdivisions));
+}
+
+// Whether every vertex of the subdivided sphere is addressable by Index.
+template <typename Index> constexpr bool IndexFits(int subdivisions) {
+  return VertexCount(subdivisions) - 1 <= std::numeric_limits<Index>::max();
+}
+
+template <typename Index> struct IndexType {
+  using type = Index;
+};
+
+// Calls `f` with IndexType<uint16_t> when the subdivided sphere fits 16-bit
+// indices and with IndexType<uint32_t> otherwise, so small meshes keep the
+// narrower index buffer. The sphere must fit 32-bit indices.
+template <typename F> decltype(auto) VisitIndexType(int subdivisions, F &&f) {
+  assert(IndexFits<uint32_t>(subdivisions));
+  if (IndexFits<uint16_t>(subdivisions))
+    return f(IndexType<uint16_t>{});
+  return f(IndexType<uint32_t>{});
+}
+
+// Open-addressing hash table from an undirected edge to the index of its
+// midpoint vertex. Slots live in one flat array and collisions are resolved
+// by linear probing, so a lookup touches a single cache line in the common
+// case and the table never allocates after construction.
+template <typename Index> class EdgeTable {
+public:
+  explicit EdgeTable(size_t edge_count) {
+    // keep the load factor at or below 1/2
+    size_t capacity = 16;
+    shift_ = 60;
+    while (capacity < edge_count * 2) {
+      capacity <<= 1;
+      --shift_;
+    }
+    slots_.assign(capacity, Slot{kEmpty, 0});
+  }
+
+  // Returns the value stored for the edge and whether it was inserted now.
+  std::pair<Index, bool> Insert(Index first, Index second, Index value) {
+    if (first > second)
+      std::swap(first, second);
+    Key key = (Key(first) << std::numeric_limits<Index>::digits) | second;
+
+    size_t mask = slots_.size() - 1;
+    // Fibonacci hashing spreads the packed key over the top bits
+    for (size_t i = (uint64_t(key) * 0x9e3779b97f4a7c15ull) >> shift_;;
+         i = (i + 1) & mask) {
+      Slot &slot = slots_[i];
+      if (slot.key == key)
+        return {slot.value, false};
+      if (slot.key == kEmpty) {
+        slot = {key, value};
+        return {value, true};
+      }
+    }
+  }
+
+private:
+  using Key = std::conditional_t<sizeof(Index) <= 2, uint32_t, uint64_t>;
+
+  // first < second for every stored edge, so no key can be all ones
+  static constexpr Key kEmpty = ~Key(0);
+
+  struct Slot {
+    Key key;
+    Index value;
+  };
+
+  std::vector<Slot> slots_;
+  int shift_;
+};
+
+template <typename Index>
+Index VertexForEdge(EdgeTable<Index> &lookup, VertexList &vertices,
+                    Index first, Index second) {
+  auto [index, inserted] =
+      lookup.Insert(first, second, static_cast<Index>(vertices.size()));
+  if (inserted) {
+    auto &edge0 = vertices[first];
+    auto &edge1 = vertices[second];
+    auto point = normalize(edge0 + edge1);
+    vertices.push_back(point);
+  }
+
+  return index;
+}
+
+// Same as above, but only numbers the new vertex and queues its midpoint in
+// `batch`. Vertex `base + i` is the batch's midpoint i; the caller appends
+// them once the pass is done.
+template <typename Index>
+Index VertexForEdge(EdgeTable<Index> &lookup, const VertexList &vertices,
+                    MidpointBatch &batch, size_t base, Index first,
+                    Index second) {
+  auto [index, inserted] =
+      lookup.Insert(first, second, static_cast<Index>(base + batch.size()));
+  if (inserted)
+    batch.Add(vertices[first], vertices[second]);
+
+  return index;
+}
+
+// How Subdivide computes new vertices. kBatched collects the midpoints of a
+// whole pass and normalizes them with SIMD at the end; kScalar normalizes
+// each one as it is created and is kept for comparison. Both give
+// bit-identical positions when built without FMA contraction, as every
+// target linking icosphere_headers is.
+enum class Normalization { kScalar, kBatched };
+
+template <typename Index>
+TriangleList<Index>
+Subdivide(VertexList &vertices, const TriangleList<Index> &triangles,
+          Normalization normalization = Normalization::kBatched) {
+  // every edge of the closed mesh is shared by exactly two triangles
+  size_t edge_count = triangles.size() * 3 / 2;
+  EdgeTable<Index> lookup(edge_count);
+  vertices.reserve(vertices.size() + edge_count);
+
+  const size_t base = vertices.size();
+  MidpointBatch batch(normalization == Normalization::kBatched ? edge_count
+                                                               : 0);
+
+  TriangleList<Index> result;
+  result.reserve(triangles.size() * 4);
+
+  for (auto &&each : triangles) {
+    std::array<Index, 3> mid;
+    for (int edge = 0; edge < 3; ++edge) {
+      Index first = each.vertices[edge];
+      Index second = each.vertices[(edge + 1) % 3];
+      mid[edge] = normalization == Normalization::kBatched
+                      ? VertexForEdge(lookup, vertices, batch, base, first,
+                                      second)
+                      : VertexForEdge(lookup, vertices, first, second);
+    }
+
+    result.push_back({each.vertices[0], mid[0], mid[2]});
+    result.push_back({each.vertices[1], mid[1], mid[0]});
+    result.push_back({each.vertices[2], mid[2], mid[1]});
+    result.push_back({mid[0], mid[1], mid[2]});
+  }
+
+  if (batch.size() > 0) {
+    vertices.resize(base + batch.size());
+    batch.Flush(&vertices[base]);
+  }
+  return result;
+}
+
+// Edge table shared by the threads of ParallelSubdivide. Slots are claimed
+// with a compare-and-swap on the key; each slot also records the first
+// position (3 * triangle + edge) at which the edge occurs and, once numbered,
+// the index of its midpoint vertex.
+template <typename Index> class ConcurrentEdgeTable {
+public:
+  explicit ConcurrentEdgeTable(size_t edge_count) {
+    size_t capacity = 16;
+    shift_ = 60;
+    while (capacity < edge_count * 2) {
+      capacity <<= 1;
+      --shift_;
+    }
+    keys_ = std::vector<std::atomic<Key>>(capacity);
+    first_ = std::vector<std::atomic<uint32_t>>(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+      keys_[i].store(kEmpty, std::memory_order_relaxed);
+      first_[i].store(~uint32_t(0), std::memory_order_relaxed);
+    }
+    indices_.resize(capacity);
+  }
+
+  // Finds or claims the slot of the edge and lowers its first position to
+  // `position`. Safe to call from several threads at once.
+  uint32_t Insert(Index first, Index second, uint32_t position) {
+    if (first > second)
+      std::swap(first, second);
+    Key key = (Key(first) << std::numeric_limits<Index>::digits) | second;
+
+    size_t mask = keys_.size() - 1;
+    size_t i = (uint64_t(key) * 0x9e3779b97f4a7c15ull) >> shift_;
+    for (;; i = (i + 1) & mask) {
+      Key current = keys_[i].load(std::memory_order_relaxed);
+      if (current == kEmpty &&
+          keys_[i].compare_exchange_strong(current, key,
+                                           std::memory_order_relaxed))
+        break;
+      if (current == key)
+        break;
+    }
+
+    auto &slot_first = first_[i];
+    uint32_t current = slot_first.load(std::memory_order_relaxed);
+    while (position < current &&
+           !slot_first.compare_exchange_weak(current, position,
+                                             std::memory_order_relaxed)) {
+    }
+    return static_cast<uint32_t>(i);
+  }
+
+  uint32_t First(uint32_t slot) const {
+    return first_[slot].load(std::memory_order_relaxed);
+  }
+
+  Index &index(uint32_t slot) { return indices_[slot]; }
+
+private:
+  using Key = std::conditional_t<sizeof(Index) <= 2, uint32_t, uint64_t>;
+
+  static constexpr Key kEmpty = ~Key(0);
+
+  std::vector<std::atomic<Key>> keys_;
+  std::vector<std::atomic<uint32_t>> first_;
+  std::vector<Index> indices_;
+  int shift_;
+};
+
+// Meshes smaller than this are subdivided serially; the extra passes of the
+// parallel version only pay off once there is enough work to spread.
+const size_t kParallelSubdivideThreshold = 4096;
+const size_t kSubdivideChunkSize = 1024;
+
+// Same result as Subdivide, computed on `pool`. The serial version numbers a
+// midpoint when its edge is first met in triangle order, so this one records
+// the first position of every edge, counts the new vertices per chunk, and
+// hands out indices from a prefix sum over the chunks. Vertex and index
+// order are therefore identical to Subdivide for any thread count.
+template <typename Index>
+TriangleList<Index> ParallelSubdivide(ThreadPool &pool, VertexList &vertices,
+                                      const TriangleList<Index> &triangles) {
+  if (pool.size() == 1 || triangles.size() < kParallelSubdivideThreshold)
+    return Subdivide(vertices, triangles);
+
+  size_t edge_count = triangles.size() * 3 / 2;
+  size_t chunk_count =
+      (triangles.size() + kSubdivideChunkSize - 1) / kSubdivideChunkSize;
+  auto chunk_range = [&](size_t chunk) {
+    size_t begin = chunk * kSubdivideChunkSize;
+    return std::make_pair(begin, std::min(begin + kSubdivideChunkSize,
+                                          triangles.size()));
+  };
+
+  ConcurrentEdgeTable<Index> lookup(edge_count);
+  std::vector<uint32_t> slots(triangles.size() * 3);
+  pool.ParallelFor(chunk_count, [&](size_t chunk) {
+    auto [begin, end] = chunk_range(chunk);
+    for (size_t t = begin; t < end; ++t) {
+      auto &each = triangles[t];
+      for (int edge = 0; edge < 3; ++edge) {
+        uint32_t position = static_cast<uint32_t>(t * 3 + edge);
+        slots[position] = lookup.Insert(
+            each.vertices[edge], each.vertices[(edge + 1) % 3], position);
+      }
+    }
+  });
+
+  // count the edges each chunk meets first, then turn the counts into the
+  // index of the first vertex the chunk creates
+  std::vector<size_t> chunk_base(chunk_count + 1, 0);
+  pool.ParallelFor(chunk_count, [&](size_t chunk) {
+    auto [begin, end] = chunk_range(chunk);
+    size_t created = 0;
+    for (size_t position = begin * 3; position < end * 3; ++position)
+      created += lookup.First(slots[position]) == position;
+    chunk_base[chunk + 1] = created;
+  });
+  chunk_base[0] = vertices.size();
+  for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+    chunk_base[chunk + 1] += chunk_base[chunk];
+
+  vertices.resize(chunk_base[chunk_count]);
+
+  pool.ParallelFor(chunk_count, [&](size_t chunk) {
+    auto [begin, end] = chunk_range(chunk);
+    size_t next = chunk_base[chunk];
+    MidpointBatch batch(chunk_base[chunk + 1] - next);
+    for (size_t position = begin * 3; position < end * 3; ++position) {
+      uint32_t slot = slots[position];
+      if (lookup.First(slot) != position)
+        continue;
+      auto &each = triangles[position / 3];
+      int edge = position % 3;
+      batch.Add(vertices[each.vertices[edge]],
+                vertices[each.vertices[(edge + 1) % 3]]);
+      lookup.index(slot) = static_cast<Index>(next++);
+    }
+    batch.Flush(&vertices[chunk_base[chunk]]);
+  });
+
+  TriangleList<Index> result(triangles.size() * 4);
+  pool.ParallelFor(chunk_count, [&](size_t chunk) {
+    auto [begin, end] = chunk_range(chunk);
+    for (size_t t = begin; t < end; ++t) {
+      auto &each = triangles[t];
+      std::array<Index, 3> mid;
+      for (int edge = 0; edge < 3; ++edge)
+        mid[edge] = lookup.index(slots[t * 3 + edge]);
+
+      result[t * 4 + 0] = {each.vertices[0], mid[0], mid[2]};
+      result[t * 4 + 1] = {each.vertices[1], mid[1], mid[0]};
+      result[t * 4 + 2] = {each.vertices[2], mid[2], mid[1]};
+      result[t * 4 + 3] = {mid[0], mid[1], mid[2]};
+    }
+  });
+
+  return result;
+}
+
+template <typename Index>
+using IndexedMesh = std::pair<VertexList, TriangleList<Index>>;
+
+template <typename Index> IndexedMesh<Index> MakeIcosahedron() {
+  VertexList vertices = icosahedron::vertices;
+  TriangleList<Index> triangles(icosahedron::triangles.size());
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    for (int corner = 0; corner < 3; ++corner)
+      triangles[i].vertices[corner] =
+          icosahedron::triangles[i].vertices[corner];
+  }
+  return {vertices, triangles};
+}
+
+template <typename Index>
+IndexedMesh<Index>
+MakeIcosphere(int subdivisions,
+              Normalization normalization = Normalization::kBatched) {
+  auto mesh = MakeIcosahedron<Index>();
+
+  for (int i = 0; i < subdivisions; ++i) {
+    mesh.second = Subdivide(mesh.first, mesh.second, normalization);
+  }
+
+  return mesh;
+}
+
+template <typename Index>
+IndexedMesh<Index> MakeIcosphere(ThreadPool &pool, int subdivisions) {
+  auto mesh = MakeIcosahedron<Index>();
+
+  for (int i = 0; i < subdivisions; ++i) {
+    mesh.second = ParallelSubdivide(pool, mesh.first, mesh.second);
+  }
+
+  return mesh;
+}
+
+struct EdgeNumbering {
+  std::array<std::pair<uint16_t, uint16_t>, 30> edges;
+  std::array<std::array<size_t, 3>, 20> face_edges;
+  std::array<std::array<bool, 3>, 20> owns_edge;
+};
+
+// The 30 edges of the base icosahedron, numbered in order of first
+// appearance, the edge id of each side of every face, and whether the face
+// is the first one to have that edge.
+inline const EdgeNumbering &BaseEdges() {
+  static const EdgeNumbering numbering = [] {
+    EdgeNumbering result;
+    size_t edge_count = 0;
+    for (size_t face = 0; face < triangles.size(); ++face) {
+      for (int edge = 0; edge < 3; ++edge) {
+        uint16_t first = triangles[face].vertices[edge];
+        uint16_t second = triangles[face].vertices[(edge + 1) % 3];
+        std::pair<uint16_t, uint16_t> key = std::minmax(first, second);
+        auto begin = result.edges.begin();
+        size_t id = std::find(begin, begin + edge_count, key) - begin;
+        result.owns_edge[face][edge] = id == edge_count;
+        if (id == edge_count)
+          result.edges[edge_count++] = key;
+        result.face_edges[face][edge] = id;
+      }
+    }
+    return result;
+  }();
+  return numbering;
+}
+
+// Builds the level `subdivisions` sphere without the intermediate levels.
+// Every base face is treated as a triangular grid with n = 2^subdivisions
+// segments per side, so the vertex and triangle buffers are sized once from
+// VertexCount/TriangleCount and every element is written exactly once.
+//
+// A grid point first appears at the level where its coordinates stop being
+// multiples of a coarser step. Computing it there as the normalized sum of
+// the two neighbouring points one step away reproduces the midpoint that
+// Subdivide would have created, so positions match MakeIcosphere exactly;
+// only the numbering differs. Vertices are laid out as the 12 corners, then
+// the interior points of the 30 base edges, then those of the 20 faces.
+//
+// When `lines` is given it receives every edge of the mesh exactly once, for
+// drawing the wireframe with a single GL_LINES call. Each grid edge is a
+// side of exactly one upward pointing grid triangle, so every face emits the
+// sides of its upward triangles and skips the boundary segments of base
+// edges owned by the neighbouring face.
+template <typename Index>
+IndexedMesh<Index> GenerateIcosphere(ThreadPool &pool, int subdivisions,
+                                     LineList<Index> *lines = nullptr) {
+  const auto &base = icosahedron::triangles;
+  const size_t n = size_t(1) << subdivisions;
+  const size_t edge_points = n - 1;
+  const size_t face_points = (n - 1) * (n - 2) / 2;
+
+  const auto &edges = BaseEdges().edges;
+  const auto &face_edges = BaseEdges().face_edges;
+  const auto &owns_edge = BaseEdges().owns_edge;
+
+  const size_t edge_base = icosahedron::vertices.size();
+  const size_t face_base = edge_base + edges.size() * edge_points;
+
+  // per-face map from grid point to vertex index
+  const size_t grid_size = (n + 1) * (n + 2) / 2;
+  std::vector<Index> grids(base.size() * grid_size);
+
+  IndexedMesh<Index> mesh;
+  auto &vertices = mesh.first;
+  auto &triangles = mesh.second;
+  vertices.resize(VertexCount(subdivisions));
+  triangles.resize(TriangleCount(subdivisions));
+  std::copy(icosahedron::vertices.begin(), icosahedron::vertices.end(),
+            vertices.begin());
+
+  std::array<size_t, 21> line_offsets{};
+  if (lines) {
+    lines->resize(EdgeCount(subdivisions));
+    for (size_t face = 0; face < base.size(); ++face) {
+      size_t count = 3 * n * (n + 1) / 2;
+      for (bool owned : owns_edge[face])
+        count -= owned ? 0 : n;
+      line_offsets[face + 1] = line_offsets[face] + count;
+    }
+  }
+
+  // index of the point `t` segments from the lower numbered end of an edge
+  auto edge_vertex = [&](size_t edge, size_t t) -> size_t {
+    if (t == 0)
+      return edges[edge].first;
+    if (t == n)
+      return edges[edge].second;
+    return edge_base + edge * edge_points + t - 1;
+  };
+
+  pool.ParallelFor(edges.size(), [&](size_t edge) {
+    for (size_t step = n / 2; step > 0; step /= 2) {
+      for (size_t t = step; t < n; t += 2 * step) {
+        vertices[edge_vertex(edge, t)] =
+            normalize(vertices[edge_vertex(edge, t - step)] +
+                      vertices[edge_vertex(edge, t + step)]);
+      }
+    }
+  });
+
+  pool.ParallelFor(base.size(), [&](size_t face) {
+    auto &corner = base[face].vertices;
+    // grid point (i, j) is corner0 + i/n (corner1 - corner0)
+    //                            + j/n (corner2 - corner0), with i + j <= n
+    Index *grid = &grids[face * grid_size];
+    auto at = [n](size_t i, size_t j) {
+      return j * (n + 1) - j * (j - 1) / 2 + i;
+    };
+    // vertex `u` segments from corner `from` along side `edge` of the face
+    auto along = [&](int edge, uint16_t from, size_t u) {
+      size_t id = face_edges[face][edge];
+      return static_cast<Index>(
+          edge_vertex(id, from == edges[id].first ? u : n - u));
+    };
+
+    size_t next = face_base + face * face_points;
+    for (size_t j = 0; j <= n; ++j) {
+      for (size_t i = 0; i + j <= n; ++i) {
+        Index &index = grid[at(i, j)];
+        if (j == 0)
+          index = along(0, corner[0], i);
+        else if (i + j == n)
+          index = along(1, corner[1], j);
+        else if (i == 0)
+          index = along(2, corner[0], j);
+        else
+          index = static_cast<Index>(next++);
+      }
+    }
+
+    for (size_t step = n / 2; step > 0; step /= 2) {
+      for (size_t j = step; j < n; j += step) {
+        for (size_t i = step; i + j < n; i += step) {
+          bool odd_i = i % (2 * step) != 0, odd_j = j % (2 * step) != 0;
+          if (!odd_i && !odd_j)
+            continue;
+          // the coarser edge this point splits: horizontal, vertical or
+          // the diagonal of a grid cell
+          size_t i0 = i, j0 = j, i1 = i, j1 = j;
+          if (odd_i)
+            i0 -= step, i1 += step;
+          if (odd_j)
+            j0 -= step, j1 += step;
+          if (odd_i && odd_j)
+            std::swap(j0, j1);
+          vertices[grid[at(i, j)]] = normalize(vertices[grid[at(i0, j0)]] +
+                                               vertices[grid[at(i1, j1)]]);
+        }
+      }
+    }
+
+    auto *out = &triangles[face * n * n];
+    for (size_t j = 0; j < n; ++j) {
+      for (size_t i = 0; i + j < n; ++i) {
+        *out++ = {grid[at(i, j)], grid[at(i + 1, j)], grid[at(i, j + 1)]};
+        if (i + j + 1 < n)
+          *out++ = {grid[at(i + 1, j)], grid[at(i + 1, j + 1)],
+                    grid[at(i, j + 1)]};
+      }
+    }
+
+    if (!lines)
+      return;
+    auto *line = &(*lines)[line_offsets[face]];
+    for (size_t j = 0; j < n; ++j) {
+      for (size_t i = 0; i + j < n; ++i) {
+        Index a = grid[at(i, j)], b = grid[at(i + 1, j)],
+              c = grid[at(i, j + 1)];
+        if (j != 0 || owns_edge[face][0])
+          *line++ = {a, b};
+        if (i + j + 1 != n || owns_edge[face][1])
+          *line++ = {b, c};
+        if (i != 0 || owns_edge[face][2])
+          *line++ = {c, a};
+      }
+    }
+  });
+
+  return mesh;
+}
+
+template <typename Index>
+IndexedMesh<Index> GenerateIcosphere(int subdivisions,
+                                     LineList<Index> *lines = nullptr) {
+  ThreadPool inline_pool(1);
+  return GenerateIcosphere<Index>(inline_pool, subdivisions, lines);
+}
+} // namespace icosahedron
@@ -5,98 +5,48 @@
 #include <glm/gtx/transform.hpp>
 #include <spdlog/spdlog.h>
 
-#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
-#include <map>
 #include <memory>
 #include <vector>
 
+#include "context.h"
+#include "icosphere.h"
+#include "mesh_cache.h"
+#include "mesh_streamer.h"
+#include "program_cache.h"
+#include "stream_buffer.h"
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 const int WINDOW_WIDTH = 600;
 const int WINDOW_HEIGHT = 400;
 
-using Vertex = glm::vec3;
-
-struct Triangle {
-  uint16_t vertices[3];
-};
-
-using TriangleList = std::vector<Triangle>;
-using VertexList = std::vector<Vertex>;
-
-// https://schneide.blog/2016/07/15/generating-an-icosphere-in-c/
-namespace icosahedron {
-const float X = .525731112119133606f;
-const float Z = .850650808352039932f;
-const float N = 0.f;
-
-static const VertexList vertices = {
-    {-X, N, Z}, {X, N, Z},   {-X, N, -Z}, {X, N, -Z}, {N, Z, X},  {N, Z, -X},
-    {N, -Z, X}, {N, -Z, -X}, {Z, X, N},   {-Z, X, N}, {Z, -X, N}, {-Z, -X, N}};
-
-static const TriangleList triangles = {
-    {0, 4, 1},  {0, 9, 4},  {9, 5, 4},  {4, 5, 8},  {4, 8, 1},
-    {8, 10, 1}, {8, 3, 10}, {5, 3, 8},  {5, 2, 3},  {2, 7, 3},
-    {7, 10, 3}, {7, 6, 10}, {7, 11, 6}, {11, 0, 6}, {0, 1, 6},
-    {6, 1, 10}, {9, 0, 11}, {9, 11, 2}, {9, 2, 5},  {7, 2, 11}};
-
-using Lookup = std::map<std::pair<uint16_t, uint16_t>, uint16_t>;
-
-uint16_t VertexForEdge(Lookup &lookup, VertexList &vertices, uint16_t first,
-                       uint16_t second) {
-  Lookup::key_type key(first, second);
-  if (key.first > key.second)
-    std::swap(key.first, key.second);
-
-  auto [it, inserted] = lookup.insert({key, vertices.size()});
-  if (inserted) {
-    auto &edge0 = vertices[first];
-    auto &edge1 = vertices[second];
-    auto point = normalize(edge0 + edge1);
-    vertices.push_back(point);
-  }
-
-  return it->second;
-}
-
-TriangleList Subdivide(VertexList &vertices, TriangleList triangles) {
-  Lookup lookup;
-  TriangleList result;
-
-  for (auto &&each : triangles) {
-    std::array<uint16_t, 3> mid;
-    for (int edge = 0; edge < 3; ++edge) {
-      mid[edge] = VertexForEdge(lookup, vertices, each.vertices[edge],
-                                each.vertices[(edge + 1) % 3]);
-    }
-
-    result.push_back({each.vertices[0], mid[0], mid[2]});
-    result.push_back({each.vertices[1], mid[1], mid[0]});
-    result.push_back({each.vertices[2], mid[2], mid[1]});
-    result.push_back({mid[0], mid[1], mid[2]});
-  }
-
-  return result;
-}
-
-using IndexedMesh = std::pair<VertexList, TriangleList>;
-
-IndexedMesh MakeIcosphere(int subdivisions) {
-  VertexList vertices = icosahedron::vertices;
-  TriangleList triangles = icosahedron::triangles;
+const char *MESH_CACHE_PATH = "icosphere.cache";
 
-  for (int i = 0; i < subdivisions; ++i) {
-    triangles = Subdivide(vertices, triangles);
-  }
+// how often draw call counts and frame times are logged, in seconds
+const double STATS_INTERVAL = 2.0;
 
-  return {vertices, triangles};
-}
-} // namespace icosahedron
+// The Frame uniform block, written into a StreamBuffer every frame. The
+// stages of a program must declare it identically.
+struct FrameUniforms {
+  glm::mat4 mvp;
+  glm::mat4 model_view;
+  // segments per base edge at unit distance from the camera
+  float detail;
+  float padding[3];
+};
 
 const char *vertex_shader_source = u8R"##(#version 400
 layout(location = 0) in vec3 vertex_position;
-uniform mat4 MVP;
+layout(std140) uniform Frame {
+  mat4 MVP;
+  mat4 MV;
+  float detail;
+};
 
 void main() {
   gl_Position = MVP * vec4(vertex_position, 1.0);
@@ -111,189 +61,297 @@ void main() {
 }
 )##";
 
-void HandleGLFWError(int error, const char *description) {
-  spdlog::error("GLFW Error: {}", description);
+// GPU level of detail: only the base icosahedron is uploaded, and the
+// tessellator splits every face and projects the new points onto the sphere.
+const char *patch_vertex_shader_source = u8R"##(#version 400
+layout(location = 0) in vec3 vertex_position;
+out vec3 control_position;
+
+void main() {
+  control_position = vertex_position;
 }
+)##";
 
-void LogShaderInfo(GLuint shader_id) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char buffer[2048];
-  glGetShaderInfoLog(shader_id, max_length, &actual_length, buffer);
-  spdlog::error("shader info log for GL index {}:\n{}", shader_id, buffer);
+const char *tess_control_shader_source = u8R"##(#version 400
+layout(vertices = 3) out;
+in vec3 control_position[];
+out vec3 evaluation_position[];
+layout(std140) uniform Frame {
+  mat4 MVP;
+  mat4 MV;
+  float detail;
+};
+
+// Depends only on the edge's end points, so the two faces sharing an edge
+// agree on its level and the surface has no cracks.
+float EdgeLevel(vec3 a, vec3 b) {
+  vec3 middle = (MV * vec4(normalize(a + b), 1.0)).xyz;
+  return clamp(detail / length(middle), 1.0, float(gl_MaxTessGenLevel));
 }
 
-void LogProgramInfo(GLuint program) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char program_log[2048];
-  glGetProgramInfoLog(program, max_length, &actual_length, program_log);
-  spdlog::error("program info log for GL index {}:\n{}", program, program_log);
+void main() {
+  evaluation_position[gl_InvocationID] = control_position[gl_InvocationID];
+  if (gl_InvocationID == 0) {
+    gl_TessLevelOuter[0] = EdgeLevel(control_position[1], control_position[2]);
+    gl_TessLevelOuter[1] = EdgeLevel(control_position[2], control_position[0]);
+    gl_TessLevelOuter[2] = EdgeLevel(control_position[0], control_position[1]);
+    gl_TessLevelInner[0] = max(gl_TessLevelOuter[0],
+                               max(gl_TessLevelOuter[1], gl_TessLevelOuter[2]));
+  }
 }
+)##";
 
-int level = 0;
-icosahedron::IndexedMesh mesh;
+const char *tess_evaluation_shader_source = u8R"##(#version 400
+layout(triangles, fractional_even_spacing, ccw) in;
+in vec3 evaluation_position[];
+layout(std140) uniform Frame {
+  mat4 MVP;
+  mat4 MV;
+  float detail;
+};
 
-GLuint vbo, ebo;
+void main() {
+  vec3 position = gl_TessCoord.x * evaluation_position[0] +
+                  gl_TessCoord.y * evaluation_position[1] +
+                  gl_TessCoord.z * evaluation_position[2];
+  gl_Position = MVP * vec4(normalize(position), 1.0);
+}
+)##";
+
+int level = 0;
+// L switches back to one GL_LINE_LOOP draw per triangle for comparison
+bool draw_line_loops = false;
+// T switches between CPU subdivision and GPU tessellation
+bool tessellate = false;
+float tessellation_detail = 16.0f;
+// the scroll wheel moves the camera towards or away from the sphere; it
+// starts at (3, 2, 2)
+float camera_distance = std::sqrt(17.0f);
+ThreadPool subdivision_pool;
+IcosphereCache mesh_cache(MESH_CACHE_PATH);
+
+// owned by main, which destroys it before the context goes away
+MeshStreamer *mesh_streamer = nullptr;
 
 void HandleKeyEvents(GLFWwindow *window, int key, int scancode, int action,
                      int mods) {
-  if (key == GLFW_KEY_UP && action == GLFW_PRESS) {
-    ++level;
+  if (action != GLFW_PRESS)
+    return;
+
+  int previous_level = level;
+  if (key == GLFW_KEY_UP) {
+    if (tessellate)
+      tessellation_detail = std::min(tessellation_detail * 2.0f, 1024.0f);
+    else if (level < icosahedron::kMaxLevel)
+      ++level;
   }
-  if (key == GLFW_KEY_DOWN && action == GLFW_PRESS && level > 0) {
-    --level;
+  if (key == GLFW_KEY_DOWN) {
+    if (tessellate)
+      tessellation_detail = std::max(tessellation_detail * 0.5f, 1.0f);
+    else if (level > 0)
+      --level;
+  }
+  if (key == GLFW_KEY_L) {
+    draw_line_loops = !draw_line_loops;
+  }
+  if (key == GLFW_KEY_T) {
+    tessellate = !tessellate;
   }
 
-  mesh = icosahedron::MakeIcosphere(level);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * mesh.first.size(),
-               &mesh.first[0], GL_DYNAMIC_DRAW);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Triangle) * mesh.second.size(),
-               &mesh.second[0], GL_DYNAMIC_DRAW);
+  if (level != previous_level)
+    mesh_streamer->Request(level);
 }
 
-int main() {
-  glfwSetErrorCallback(HandleGLFWError);
+void HandleScrollEvents(GLFWwindow *window, double x_offset, double y_offset) {
+  camera_distance *= std::pow(0.9f, static_cast<float>(y_offset));
+  camera_distance = std::clamp(camera_distance, 1.2f, 50.0f);
+}
 
-  // start GL context and O/S window using the GLFW helper library
-  if (!glfwInit()) {
-    spdlog::error("could not start GLFW3");
+int main(int argc, char **argv) {
+  ContextOptions options;
+  options.width = WINDOW_WIDTH;
+  options.height = WINDOW_HEIGHT;
+  if (!ParseContextOptions(argc, argv, options))
     return 1;
-  }
-
-  // Anti-Aliasing
-  glfwWindowHint(GLFW_SAMPLES, 4);
-
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  GLFWwindow *window =
-      glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Hello Matrix", NULL, NULL);
 
-  glfwSetKeyCallback(window, HandleKeyEvents);
-
-  if (!window) {
-    spdlog::error("could not open window with GLFW3");
-    glfwTerminate();
+  auto context = Context::Create(options, "Hello Matrix");
+  if (!context)
     return 1;
-  }
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1); // Enable vsync
 
-  if (!gladLoadGL()) {
-    spdlog::error("failed to initialize OpenGL loader");
-    return 1;
-  }
-
-  // get version info
-  spdlog::info("Renderer: {}", glGetString(GL_RENDERER));
-  spdlog::info("OpenGL version supported: {}", glGetString(GL_VERSION));
+  context->SetKeyCallback(HandleKeyEvents);
+  if (GLFWwindow *window = context->window())
+    glfwSetScrollCallback(window, HandleScrollEvents);
 
   glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
-  mesh = icosahedron::MakeIcosphere(level);
-
-  // GLuint vbo = 0;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * mesh.first.size(),
-               &mesh.first[0], GL_DYNAMIC_DRAW);
-
-  GLuint vao = 0;
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-  glEnableVertexAttribArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12, BUFFER_OFFSET(0));
-
-  // GLuint ebo;
-  glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Triangle) * mesh.second.size(),
-               &mesh.second[0], GL_DYNAMIC_DRAW);
-
-  int params = -1;
-  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader);
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", vertex_shader);
-    LogShaderInfo(vertex_shader);
-    return 1; // or exit or something
-  }
-
-  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", fragment_shader);
-    LogShaderInfo(fragment_shader);
-    return 1; // or exit or something
-  }
-
-  GLuint program = glCreateProgram();
-  glAttachShader(program, fragment_shader);
-  glAttachShader(program, vertex_shader);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("could not link shader program GL index {}", program);
-    LogProgramInfo(program);
+  auto streamer = std::make_unique<MeshStreamer>(mesh_cache, subdivision_pool);
+  mesh_streamer = streamer.get();
+  streamer->Request(level);
+
+  ProgramCache programs;
+  GLuint program =
+      programs.Get({{GL_VERTEX_SHADER, vertex_shader_source},
+                    {GL_FRAGMENT_SHADER, fragment_shader_source}});
+  GLuint tessellation_program =
+      programs.Get({{GL_VERTEX_SHADER, patch_vertex_shader_source},
+                    {GL_TESS_CONTROL_SHADER, tess_control_shader_source},
+                    {GL_TESS_EVALUATION_SHADER, tess_evaluation_shader_source},
+                    {GL_FRAGMENT_SHADER, fragment_shader_source}});
+  if (!program || !tessellation_program)
     return 1;
-  }
-
-  GLuint uniform_mvp = glGetUniformLocation(program, "MVP");
-
-  glm::vec3 camera_position(3.0f, 2.0f, 2.0f);
+  LabelObject(GL_PROGRAM, program, "icosphere");
+  LabelObject(GL_PROGRAM, tessellation_program, "tessellated icosphere");
+
+  const GLuint FRAME_BINDING = 0;
+  for (GLuint each : {program, tessellation_program})
+    glUniformBlockBinding(each, glGetUniformBlockIndex(each, "Frame"),
+                          FRAME_BINDING);
+  GLint uniform_alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+  StreamBuffer frame_stream(
+      std::max<size_t>(sizeof(FrameUniforms), uniform_alignment));
+  LabelObject(GL_BUFFER, frame_stream.buffer(), "frame uniforms");
+
+  // the tessellation mode draws the base icosahedron, uploaded once
+  GLuint patch_vao, patch_vbo, patch_ebo;
+  glGenVertexArrays(1, &patch_vao);
+  glGenBuffers(1, &patch_vbo);
+  glGenBuffers(1, &patch_ebo);
+  glBindVertexArray(patch_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, patch_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * icosahedron::vertices.size(),
+               icosahedron::vertices.data(), GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), NULL);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, patch_ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               sizeof(Triangle<uint16_t>) * icosahedron::triangles.size(),
+               icosahedron::triangles.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+  LabelObject(GL_BUFFER, patch_vbo, "icosahedron vertices");
+  LabelObject(GL_BUFFER, patch_ebo, "icosahedron indices");
+  glPatchParameteri(GL_PATCH_VERTICES, 3);
+
+  glm::vec3 camera_direction = glm::normalize(glm::vec3(3.0f, 2.0f, 2.0f));
   glm::vec3 camera_target(0.0f, 0.0f, 0.0f);
   glm::vec3 up_vector(0.0f, 1.0f, 0.0f);
-  glm::mat4 view = glm::lookAt(camera_position, camera_target, up_vector);
   glm::mat4 projection = glm::perspective(
-      glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f,
+      glm::radians(45.0f), (float)options.width / (float)options.height, 0.1f,
       100.0f);
   float angular_velocity = glm::pi<float>() * 0.1f;
 
-  while (!glfwWindowShouldClose(window)) {
-    double time = glfwGetTime();
+  // headless time is simulated, so frame cost is measured on the wall clock
+  using Clock = std::chrono::steady_clock;
+  double stats_start = context->Time();
+  auto stats_clock_start = Clock::now();
+  int stats_frames = 0;
+  long stats_draw_calls = 0;
+  RenderState::Counts stats_state_calls;
+
+  FrameProfiler &profiler = context->profiler();
+  RenderState &state = context->state();
+  while (!context->ShouldClose()) {
+    profiler.Begin("update");
+    double time = context->Time();
     float angle = angular_velocity * time;
     glm::mat4 model = glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
 
+    glm::mat4 view = glm::lookAt(camera_direction * camera_distance,
+                                 camera_target, up_vector);
+    FrameUniforms uniforms;
+    uniforms.model_view = view * model;
+    uniforms.mvp = projection * uniforms.model_view;
+    uniforms.detail = tessellation_detail;
+
+    // straight into memory the GPU reads
+    frame_stream.Begin();
+    auto frame = frame_stream.Allocate(sizeof(uniforms), uniform_alignment);
+    if (frame.data)
+      std::memcpy(frame.data, &uniforms, sizeof(uniforms));
+    frame_stream.End();
+    // without this frame's uniforms nothing is drawn, rather than reading a
+    // region the GPU may still be using
+    if (frame.data)
+      state.BindBufferRange(GL_UNIFORM_BUFFER, FRAME_BINDING,
+                            frame_stream.buffer(), frame.offset,
+                            sizeof(uniforms));
+
+    // keeps drawing the previous level until the requested one is resident
+    profiler.Begin("stream");
+    streamer->Update();
+    const GpuMesh &mesh = streamer->front();
+
     // wipe the drawing surface clear
+    profiler.Begin("clear");
     glClear(GL_COLOR_BUFFER_BIT);
-    glUseProgram(program);
-    auto mvp = projection * view * model;
-    glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, &mvp[0][0]);
-
-    glBindVertexArray(vao);
-    // draw points 0-3 from the currently bound VAO with current in-use shader
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    for (int i = 0; i < mesh.second.size(); ++i)
-      glDrawElements(GL_LINE_LOOP, 3, GL_UNSIGNED_SHORT,
-                     BUFFER_OFFSET(sizeof(GLushort) * 3 * i));
-    // put the stuff we've been drawing onto the display
-    glfwSwapBuffers(window);
-    // update other events like input handling
-    glfwPollEvents();
-
-    if (GLFW_PRESS == glfwGetKey(window, GLFW_KEY_ESCAPE)) {
-      glfwSetWindowShouldClose(window, 1);
+
+    profiler.Begin("draw");
+    if (!frame.data) {
+      // the error is already logged
+    } else if (tessellate) {
+      state.UseProgram(tessellation_program);
+      state.BindVertexArray(patch_vao);
+      glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+      glDrawElements(GL_PATCHES, 3 * icosahedron::triangles.size(),
+                     GL_UNSIGNED_SHORT, NULL);
+      glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+      stats_draw_calls += 1;
+    } else {
+      state.UseProgram(program);
+      state.BindVertexArray(mesh.vao);
+      if (draw_line_loops) {
+        for (int i = 0; i < mesh.triangle_count; ++i)
+          glDrawElements(GL_LINE_LOOP, 3, mesh.index_type,
+                         BUFFER_OFFSET(mesh.index_size * 3 * i));
+        stats_draw_calls += mesh.triangle_count;
+      } else {
+        // every edge exactly once, in a single call
+        glDrawElements(GL_LINES, 2 * mesh.line_count, mesh.index_type,
+                       BUFFER_OFFSET(mesh.line_offset));
+        stats_draw_calls += 1;
+      }
+    }
+    context->EndFrame();
+
+    ++stats_frames;
+    stats_state_calls.issued += state.last_frame().issued;
+    stats_state_calls.skipped += state.last_frame().skipped;
+    if (time - stats_start >= STATS_INTERVAL) {
+      std::chrono::duration<double, std::milli> elapsed =
+          Clock::now() - stats_clock_start;
+      if (tessellate)
+        spdlog::info("tessellation detail {} at distance {:.2f}: {} draw "
+                     "calls/frame, {:.3f} ms/frame, state calls/frame {} "
+                     "issued {} skipped",
+                     tessellation_detail, camera_distance,
+                     stats_draw_calls / stats_frames,
+                     elapsed.count() / stats_frames,
+                     stats_state_calls.issued / stats_frames,
+                     stats_state_calls.skipped / stats_frames);
+      else
+        spdlog::info("level {} {}: {} draw calls/frame, {:.3f} ms/frame, "
+                     "state calls/frame {} issued {} skipped",
+                     mesh.level, draw_line_loops ? "line loops" : "lines",
+                     stats_draw_calls / stats_frames,
+                     elapsed.count() / stats_frames,
+                     stats_state_calls.issued / stats_frames,
+                     stats_state_calls.skipped / stats_frames);
+      stats_start = time;
+      stats_clock_start = Clock::now();
+      stats_frames = 0;
+      stats_draw_calls = 0;
+      stats_state_calls = RenderState::Counts();
     }
   }
 
-  glDetachShader(program, vertex_shader);
-  glDetachShader(program, fragment_shader);
+  glDeleteVertexArrays(1, &patch_vao);
+  glDeleteBuffers(1, &patch_vbo);
+  glDeleteBuffers(1, &patch_ebo);
 
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+  // the streamer's worker may still be adding levels to the cache
+  mesh_streamer = nullptr;
+  streamer.reset();
+  mesh_cache.Save();
 
-  // close GL context and any other GLFW resources
-  glfwTerminate();
   return 0;
 }
@@ -0,0 +1,264 @@
+#include "mesh_cache.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#include "mesh_optimizer.h"
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+const char kMagic[4] = {'I', 'C', 'O', 'S'};
+const size_t kAlignment = 16;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t entry_count;
+  uint32_t vertex_size;
+};
+
+struct FileEntry {
+  int32_t level;
+  uint32_t index_size;
+  uint64_t vertex_offset;
+  uint64_t vertex_count;
+  uint64_t index_offset;
+  uint64_t triangle_count;
+  uint64_t line_offset;
+  uint64_t line_count;
+};
+
+size_t Align(size_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Whether `count` elements of `size` bytes at `offset` lie within the first
+// `file_size` bytes, without overflowing on corrupt values.
+bool InFile(uint64_t offset, uint64_t count, uint64_t size,
+            uint64_t file_size) {
+  return offset <= file_size && count <= (file_size - offset) / size;
+}
+} // namespace
+
+IcosphereCache::IcosphereCache(std::string path) : path_(std::move(path)) {
+  Map();
+}
+
+IcosphereCache::~IcosphereCache() { Unmap(); }
+
+MeshView IcosphereCache::Get(ThreadPool &pool, int level) {
+  if (auto it = mapped_.find(level); it != mapped_.end())
+    return it->second;
+
+  auto it = generated_.find(level);
+  if (it == generated_.end()) {
+    Entry entry;
+    icosahedron::VisitIndexType(level, [&](auto type) {
+      using Index = typename decltype(type)::type;
+      Indices<Index> indices;
+      auto mesh = icosahedron::GenerateIcosphere<Index>(pool, level);
+      OptimizeMesh(mesh.first, mesh.second, &indices.lines);
+      entry.vertices = std::move(mesh.first);
+      indices.triangles = std::move(mesh.second);
+      entry.indices = std::move(indices);
+    });
+    it = generated_.emplace(level, std::move(entry)).first;
+  }
+
+  return View(it->second);
+}
+
+MeshView IcosphereCache::View(const Entry &entry) {
+  return std::visit(
+      [&](auto &indices) {
+        return MeshView{entry.vertices.data(),
+                        entry.vertices.size(),
+                        indices.triangles.data(),
+                        indices.triangles.size(),
+                        indices.lines.data(),
+                        indices.lines.size(),
+                        sizeof(indices.triangles[0].vertices[0])};
+      },
+      entry.indices);
+}
+
+bool IcosphereCache::Save() {
+  if (generated_.empty())
+    return true;
+
+  std::map<int, MeshView> views = mapped_;
+  for (auto &[level, entry] : generated_)
+    views[level] = View(entry);
+
+  std::vector<FileEntry> entries;
+  size_t offset = Align(sizeof(FileHeader) + sizeof(FileEntry) * views.size());
+  for (auto &[level, view] : views) {
+    FileEntry entry{};
+    entry.level = level;
+    entry.index_size = view.index_size;
+    entry.vertex_offset = offset;
+    entry.vertex_count = view.vertex_count;
+    offset = Align(offset + sizeof(Vertex) * view.vertex_count);
+    entry.index_offset = offset;
+    entry.triangle_count = view.triangle_count;
+    offset = Align(offset + view.index_size * 3 * view.triangle_count);
+    entry.line_offset = offset;
+    entry.line_count = view.line_count;
+    offset = Align(offset + view.index_size * 2 * view.line_count);
+    entries.push_back(entry);
+  }
+
+  // write next to the old file and rename over it, so the current mapping
+  // stays intact and a crash never leaves a truncated cache behind
+  std::string temporary = path_ + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.entry_count = entries.size();
+    header.vertex_size = sizeof(Vertex);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()),
+               sizeof(FileEntry) * entries.size());
+
+    auto pad_to = [&file](uint64_t position) {
+      static const char zeros[kAlignment] = {};
+      file.write(zeros, position - static_cast<uint64_t>(file.tellp()));
+    };
+    auto view_it = views.begin();
+    for (auto &entry : entries) {
+      const MeshView &view = (view_it++)->second;
+      pad_to(entry.vertex_offset);
+      file.write(reinterpret_cast<const char *>(view.vertices),
+                 sizeof(Vertex) * view.vertex_count);
+      pad_to(entry.index_offset);
+      file.write(static_cast<const char *>(view.indices),
+                 view.index_size * 3 * view.triangle_count);
+      pad_to(entry.line_offset);
+      file.write(static_cast<const char *>(view.lines),
+                 view.index_size * 2 * view.line_count);
+    }
+    if (!file) {
+      spdlog::error("could not write icosphere cache {}", temporary);
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(temporary.c_str(), path_.c_str()) != 0) {
+    spdlog::error("could not replace icosphere cache {}", path_);
+    std::remove(temporary.c_str());
+    return false;
+  }
+  spdlog::info("saved {} icosphere levels to {}", views.size(), path_);
+  return true;
+}
+
+void IcosphereCache::Map() {
+#ifdef _WIN32
+  // no mmap here; read the whole file instead
+  std::ifstream file(path_, std::ios::binary);
+  if (!file)
+    return;
+  buffer_.assign(std::istreambuf_iterator<char>(file),
+                 std::istreambuf_iterator<char>());
+  mapping_ = buffer_.data();
+  mapping_size_ = buffer_.size();
+#else
+  int fd = open(path_.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *address =
+        mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address != MAP_FAILED) {
+      mapping_ = static_cast<const unsigned char *>(address);
+      mapping_size_ = info.st_size;
+    }
+  }
+  close(fd);
+#endif
+  if (!mapping_)
+    return;
+
+  auto reject = [this](const char *reason) {
+    spdlog::warn("ignoring icosphere cache {}: {}", path_, reason);
+    mapped_.clear();
+    Unmap();
+  };
+
+  FileHeader header;
+  if (mapping_size_ < sizeof(header))
+    return reject("truncated header");
+  std::memcpy(&header, mapping_, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    return reject("bad magic");
+  if (header.version != kVersion)
+    return reject("version mismatch");
+  if (header.vertex_size != sizeof(Vertex))
+    return reject("vertex layout mismatch");
+  if (mapping_size_ <
+      sizeof(header) + sizeof(FileEntry) * uint64_t(header.entry_count))
+    return reject("truncated entry table");
+
+  for (uint32_t i = 0; i < header.entry_count; ++i) {
+    FileEntry entry;
+    std::memcpy(&entry, mapping_ + sizeof(header) + sizeof(FileEntry) * i,
+                sizeof(entry));
+    if (entry.level < 0 || entry.level > icosahedron::kMaxLevel ||
+        entry.vertex_count != icosahedron::VertexCount(entry.level) ||
+        entry.triangle_count != icosahedron::TriangleCount(entry.level) ||
+        entry.line_count != icosahedron::EdgeCount(entry.level))
+      return reject("bad entry");
+    if ((entry.index_size != 2 && entry.index_size != 4) ||
+        (entry.index_size == 2 &&
+         !icosahedron::IndexFits<uint16_t>(entry.level)) ||
+        entry.vertex_offset % kAlignment != 0 ||
+        entry.index_offset % kAlignment != 0 ||
+        entry.line_offset % kAlignment != 0 ||
+        !InFile(entry.vertex_offset, entry.vertex_count, sizeof(Vertex),
+                mapping_size_) ||
+        !InFile(entry.index_offset, entry.triangle_count,
+                entry.index_size * 3, mapping_size_) ||
+        !InFile(entry.line_offset, entry.line_count, entry.index_size * 2,
+                mapping_size_))
+      return reject("bad entry");
+
+    mapped_[entry.level] = MeshView{
+        reinterpret_cast<const Vertex *>(mapping_ + entry.vertex_offset),
+        entry.vertex_count,
+        mapping_ + entry.index_offset,
+        entry.triangle_count,
+        mapping_ + entry.line_offset,
+        entry.line_count,
+        entry.index_size};
+  }
+  spdlog::info("mapped {} icosphere levels from {}", mapped_.size(), path_);
+}
+
+void IcosphereCache::Unmap() {
+  if (!mapping_)
+    return;
+#ifdef _WIN32
+  buffer_.clear();
+#else
+  munmap(const_cast<unsigned char *>(mapping_), mapping_size_);
+#endif
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+}
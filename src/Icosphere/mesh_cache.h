@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "icosphere.h"
+
+// Vertices, packed triangle indices and unique edges of one cached sphere,
+// ready to be handed to glBufferData. The pointers stay valid as long as the
+// cache.
+struct MeshView {
+  const Vertex *vertices;
+  size_t vertex_count;
+  const void *indices;
+  size_t triangle_count;
+  const void *lines;
+  size_t line_count;
+  size_t index_size;
+};
+
+// Icosphere meshes keyed by subdivision level. Levels are looked up in
+// memory first, then in a binary cache file that is memory-mapped when the
+// cache is opened, and are generated and run through OptimizeMesh only when
+// neither has them. Save() writes every known level back so the next run
+// can map them directly.
+//
+// The file is a header, a table of entries and the raw vertex, triangle and
+// line arrays, each aligned to 16 bytes. It uses the native byte order and is
+// rejected as a whole when the magic, version or any entry does not match.
+class IcosphereCache {
+public:
+  // Bump whenever the generator, the optimizer or the file layout changes.
+  static constexpr uint32_t kVersion = 3;
+
+  explicit IcosphereCache(std::string path);
+  ~IcosphereCache();
+
+  IcosphereCache(const IcosphereCache &) = delete;
+  IcosphereCache &operator=(const IcosphereCache &) = delete;
+
+  MeshView Get(ThreadPool &pool, int level);
+
+  // Rewrites the cache file if any level was generated since it was opened.
+  // Returns false if the file could not be written.
+  bool Save();
+
+private:
+  template <typename Index> struct Indices {
+    TriangleList<Index> triangles;
+    LineList<Index> lines;
+  };
+
+  struct Entry {
+    VertexList vertices;
+    std::variant<Indices<uint16_t>, Indices<uint32_t>> indices;
+  };
+
+  static MeshView View(const Entry &entry);
+
+  void Map();
+  void Unmap();
+
+  std::string path_;
+  std::map<int, Entry> generated_;
+  std::map<int, MeshView> mapped_;
+
+  const unsigned char *mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  // backs the mapping on platforms without mmap
+  std::vector<unsigned char> buffer_;
+};
@@ -0,0 +1,219 @@
+#include "mesh_streamer.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "debug_output.h"
+
+namespace {
+const size_t kStagingAlignment = 64;
+
+// triangles and lines are staged back to back so one copy moves both
+size_t IndexBytes(const MeshView &mesh) {
+  return mesh.index_size * (3 * mesh.triangle_count + 2 * mesh.line_count);
+}
+
+size_t Align(size_t offset) {
+  return (offset + kStagingAlignment - 1) / kStagingAlignment *
+         kStagingAlignment;
+}
+} // namespace
+
+MeshStreamer::MeshStreamer(IcosphereCache &cache, ThreadPool &pool)
+    : cache_(cache), pool_(pool) {
+  persistent_ = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+  if (!persistent_)
+    spdlog::info("ARB_buffer_storage unavailable, mapping staging per upload");
+
+  for (auto &mesh : meshes_) {
+    glGenVertexArrays(1, &mesh.vao);
+    glGenBuffers(1, &mesh.vbo);
+    glGenBuffers(1, &mesh.ebo);
+    glBindVertexArray(mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+    size_t index = &mesh - meshes_;
+    LabelObject(GL_BUFFER, mesh.vbo,
+                "icosphere mesh " + std::to_string(index) + " vertices");
+    LabelObject(GL_BUFFER, mesh.ebo,
+                "icosphere mesh " + std::to_string(index) + " indices");
+  }
+  glBindVertexArray(0);
+
+  worker_ = std::thread([this] { Work(); });
+}
+
+MeshStreamer::~MeshStreamer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  worker_.join();
+
+  if (fence_)
+    glDeleteSync(fence_);
+  if (staging_data_) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, staging_);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+  }
+  glDeleteBuffers(1, &staging_);
+  for (auto &mesh : meshes_) {
+    glDeleteVertexArrays(1, &mesh.vao);
+    glDeleteBuffers(1, &mesh.vbo);
+    glDeleteBuffers(1, &mesh.ebo);
+  }
+}
+
+void MeshStreamer::Request(int level) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requested_ = level;
+  }
+  wake_.notify_all();
+}
+
+bool MeshStreamer::Update() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  switch (state_) {
+  case State::kBuilt: {
+    index_offset_ = Align(sizeof(Vertex) * built_.vertex_count);
+    ReserveStaging(index_offset_ + IndexBytes(built_));
+    if (!staging_data_) {
+      spdlog::error("could not map staging buffer for level {}", building_);
+      requested_ = meshes_[front_].level;
+      state_ = State::kIdle;
+      return false;
+    }
+    state_ = State::kWriting;
+    lock.unlock();
+    wake_.notify_all();
+    return false;
+  }
+
+  case State::kWritten: {
+    glBindBuffer(GL_COPY_READ_BUFFER, staging_);
+    if (!persistent_) {
+      glUnmapBuffer(GL_COPY_READ_BUFFER);
+      staging_data_ = nullptr;
+    }
+
+    GpuMesh &back = meshes_[1 - front_];
+    size_t vertex_bytes = sizeof(Vertex) * built_.vertex_count;
+    size_t index_bytes = IndexBytes(built_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, back.vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, vertex_bytes, nullptr, GL_STATIC_DRAW);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        vertex_bytes);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, back.ebo);
+    glBufferData(GL_COPY_WRITE_BUFFER, index_bytes, nullptr, GL_STATIC_DRAW);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        index_offset_, 0, index_bytes);
+
+    back.level = building_;
+    back.triangle_count = built_.triangle_count;
+    back.line_count = built_.line_count;
+    back.line_offset = built_.index_size * 3 * built_.triangle_count;
+    back.index_size = built_.index_size;
+    back.index_type = built_.index_size == sizeof(GLushort)
+                          ? GL_UNSIGNED_SHORT
+                          : GL_UNSIGNED_INT;
+
+    fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    state_ = State::kCopying;
+    return false;
+  }
+
+  case State::kCopying: {
+    GLenum status = glClientWaitSync(fence_, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      return false;
+    glDeleteSync(fence_);
+    fence_ = nullptr;
+
+    front_ = 1 - front_;
+    state_ = State::kIdle;
+    lock.unlock();
+    wake_.notify_all();
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+void MeshStreamer::ReserveStaging(size_t size) {
+  // staging is idle here: the previous copy's fence has already signalled
+  if (size > staging_size_) {
+    if (staging_data_) {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, staging_);
+      glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+      staging_data_ = nullptr;
+    }
+    glDeleteBuffers(1, &staging_);
+
+    staging_size_ = std::max(size, staging_size_ * 2);
+    glGenBuffers(1, &staging_);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, staging_);
+    LabelObject(GL_BUFFER, staging_, "icosphere staging");
+    if (persistent_) {
+      GLbitfield flags =
+          GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_COPY_WRITE_BUFFER, staging_size_, nullptr, flags);
+      staging_data_ = static_cast<unsigned char *>(
+          glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, staging_size_, flags));
+      return;
+    }
+    glBufferData(GL_COPY_WRITE_BUFFER, staging_size_, nullptr,
+                 GL_STREAM_COPY);
+  }
+
+  if (!persistent_) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, staging_);
+    staging_data_ = static_cast<unsigned char *>(glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  }
+}
+
+void MeshStreamer::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] {
+      return stopping_ || state_ == State::kWriting ||
+             (state_ == State::kIdle && requested_ >= 0 &&
+              requested_ != meshes_[front_].level);
+    });
+    if (stopping_)
+      return;
+
+    if (state_ == State::kWriting) {
+      MeshView mesh = built_;
+      unsigned char *staging = staging_data_;
+      size_t index_offset = index_offset_;
+      lock.unlock();
+      std::memcpy(staging, mesh.vertices, sizeof(Vertex) * mesh.vertex_count);
+      size_t triangle_bytes = mesh.index_size * 3 * mesh.triangle_count;
+      std::memcpy(staging + index_offset, mesh.indices, triangle_bytes);
+      std::memcpy(staging + index_offset + triangle_bytes, mesh.lines,
+                  mesh.index_size * 2 * mesh.line_count);
+      lock.lock();
+      state_ = State::kWritten;
+      continue;
+    }
+
+    building_ = requested_;
+    state_ = State::kBuilding;
+    lock.unlock();
+    MeshView mesh = cache_.Get(pool_, building_);
+    lock.lock();
+    built_ = mesh;
+    state_ = State::kBuilt;
+  }
+}
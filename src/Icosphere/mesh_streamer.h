@@ -0,0 +1,91 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include "mesh_cache.h"
+
+// A sphere level resident on the GPU, with its own vertex array object. The
+// element buffer holds the triangles followed by the unique edges, which
+// start `line_offset` bytes in.
+struct GpuMesh {
+  GLuint vao = 0;
+  GLuint vbo = 0;
+  GLuint ebo = 0;
+  int level = -1;
+  GLsizei triangle_count = 0;
+  GLsizei line_count = 0;
+  size_t line_offset = 0;
+  GLenum index_type = GL_UNSIGNED_SHORT;
+  size_t index_size = sizeof(GLushort);
+};
+
+// Builds icosphere levels on a background thread and streams them to the
+// GPU without stalling the render thread. The worker fetches the mesh from
+// the cache and writes it into a mapped staging buffer; the render thread
+// then copies staging into the back mesh on the GPU, fences the copy and
+// swaps the back mesh to the front once the fence has signalled. Until then
+// the previous level keeps being drawn.
+//
+// The staging buffer is persistently mapped when ARB_buffer_storage is
+// available and mapped once per upload otherwise.
+class MeshStreamer {
+public:
+  // Must be created and destroyed with the GL context current. `cache` and
+  // `pool` are used only from the worker thread until this is destroyed.
+  MeshStreamer(IcosphereCache &cache, ThreadPool &pool);
+  ~MeshStreamer();
+
+  MeshStreamer(const MeshStreamer &) = delete;
+  MeshStreamer &operator=(const MeshStreamer &) = delete;
+
+  // Asks for `level` to become the front mesh. Only the latest request is
+  // kept, so stepping through levels quickly skips the ones in between.
+  void Request(int level);
+
+  // Advances the upload by at most one step and never blocks on the GPU.
+  // Call once per frame on the render thread; returns true when a new mesh
+  // has just become the front mesh.
+  bool Update();
+
+  const GpuMesh &front() const { return meshes_[front_]; }
+
+private:
+  enum class State {
+    kIdle,     // waiting for a request that differs from the front level
+    kBuilding, // worker is fetching or generating the mesh
+    kBuilt,    // render thread has to provide a mapped staging buffer
+    kWriting,  // worker is copying the mesh into staging
+    kWritten,  // render thread has to issue the GPU copy
+    kCopying,  // GPU copy in flight, waiting for the fence
+  };
+
+  void Work();
+  void ReserveStaging(size_t size);
+
+  IcosphereCache &cache_;
+  ThreadPool &pool_;
+  std::thread worker_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  State state_ = State::kIdle;
+  bool stopping_ = false;
+  int requested_ = -1;
+  int building_ = -1;
+  MeshView built_{};
+
+  GpuMesh meshes_[2];
+  int front_ = 0;
+
+  bool persistent_ = false;
+  GLuint staging_ = 0;
+  size_t staging_size_ = 0;
+  unsigned char *staging_data_ = nullptr;
+  size_t index_offset_ = 0;
+  GLsync fence_ = nullptr;
+};
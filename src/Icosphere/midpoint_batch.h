@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIDPOINT_BATCH_SSE2
+#endif
+
+// Scales `count` vectors, stored as separate x, y and z arrays, to unit
+// length in place. Computes x / |v| as x * (1 / sqrt(x*x + y*y + z*z)) in the
+// same order as glm::normalize, so results are bit-identical to it as long
+// as the sum is not contracted into FMAs; icosphere_headers turns that off.
+inline void NormalizeScalar(float *x, float *y, float *z, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    float scale = 1.0f / std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+    x[i] *= scale;
+    y[i] *= scale;
+    z[i] *= scale;
+  }
+}
+
+// Same as NormalizeScalar, eight lanes at a time with AVX or four with SSE2.
+// Uses full precision sqrt and division rather than rsqrt, so the results
+// still match the scalar path exactly.
+inline void Normalize(float *x, float *y, float *z, size_t count) {
+  size_t i = 0;
+#if defined(__AVX__)
+  const __m256 one = _mm256_set1_ps(1.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m256 vx = _mm256_loadu_ps(x + i);
+    __m256 vy = _mm256_loadu_ps(y + i);
+    __m256 vz = _mm256_loadu_ps(z + i);
+    __m256 length_squared = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)),
+        _mm256_mul_ps(vz, vz));
+    __m256 scale = _mm256_div_ps(one, _mm256_sqrt_ps(length_squared));
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(vx, scale));
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(vy, scale));
+    _mm256_storeu_ps(z + i, _mm256_mul_ps(vz, scale));
+  }
+#elif defined(MIDPOINT_BATCH_SSE2)
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 vx = _mm_loadu_ps(x + i);
+    __m128 vy = _mm_loadu_ps(y + i);
+    __m128 vz = _mm_loadu_ps(z + i);
+    __m128 length_squared = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+        _mm_mul_ps(vz, vz));
+    __m128 scale = _mm_div_ps(one, _mm_sqrt_ps(length_squared));
+    _mm_storeu_ps(x + i, _mm_mul_ps(vx, scale));
+    _mm_storeu_ps(y + i, _mm_mul_ps(vy, scale));
+    _mm_storeu_ps(z + i, _mm_mul_ps(vz, scale));
+  }
+#endif
+  NormalizeScalar(x + i, y + i, z + i, count - i);
+}
+
+// Edge midpoints waiting to be projected onto the unit sphere. Subdivision
+// creates new vertices at consecutive indices, so the batch only stores the
+// unnormalized sum of each new edge's end points, in creation order, and
+// normalizes them all in one vectorized pass when it is flushed.
+class MidpointBatch {
+public:
+  explicit MidpointBatch(size_t capacity)
+      : x_(capacity), y_(capacity), z_(capacity) {}
+
+  // Queues the midpoint of the edge from `first` to `second` and returns its
+  // position in the batch. At most `capacity` midpoints fit.
+  size_t Add(const glm::vec3 &first, const glm::vec3 &second) {
+    x_[size_] = first.x + second.x;
+    y_[size_] = first.y + second.y;
+    z_[size_] = first.z + second.z;
+    return size_++;
+  }
+
+  size_t size() const { return size_; }
+
+  // Normalizes the queued midpoints, writes midpoint i to vertices[i] and
+  // empties the batch.
+  void Flush(glm::vec3 *vertices) {
+    Normalize(x_.data(), y_.data(), z_.data(), size_);
+    for (size_t i = 0; i < size_; ++i)
+      vertices[i] = glm::vec3(x_[i], y_[i], z_[i]);
+    size_ = 0;
+  }
+
+private:
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  size_t size_ = 0;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run data-parallel loops. The calling
+// thread takes part in every loop, so a pool of size 1 has no workers and
+// runs everything inline.
+class ThreadPool {
+public:
+  explicit ThreadPool(
+      unsigned thread_count = std::thread::hardware_concurrency()) {
+    for (unsigned i = 1; i < std::max(thread_count, 1u); ++i)
+      workers_.emplace_back([this] { Work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker : workers_)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Number of threads taking part in a loop, including the caller.
+  unsigned size() const { return workers_.size() + 1; }
+
+  // Calls `body(chunk)` for every chunk in [0, chunk_count) and returns once
+  // all of them have finished. Chunks may run in any order on any thread.
+  void ParallelFor(size_t chunk_count,
+                   const std::function<void(size_t)> &body) {
+    if (workers_.empty() || chunk_count <= 1) {
+      for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+        body(chunk);
+      return;
+    }
+
+    auto loop = std::make_shared<Loop>();
+    loop->body = &body;
+    loop->chunk_count = chunk_count;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      loop_ = loop;
+      ++generation_;
+    }
+    wake_.notify_all();
+
+    RunChunks(*loop);
+
+    // wait until every worker has let go of `body` before it goes out of scope
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    loop_.reset();
+  }
+
+private:
+  // One ParallelFor call. Each has its own chunk counter, so a worker that
+  // wakes after the loop it was woken for has finished only finds that
+  // loop's chunks all taken, and never takes one of the next loop.
+  struct Loop {
+    const std::function<void(size_t)> *body = nullptr;
+    size_t chunk_count = 0;
+    std::atomic<size_t> next_chunk{0};
+  };
+
+  void Work() {
+    size_t seen = 0;
+    for (;;) {
+      std::shared_ptr<Loop> loop;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+        if (stopping_)
+          return;
+        seen = generation_;
+        // null if the loop already finished without this worker
+        loop = loop_;
+        ++busy_;
+      }
+
+      if (loop)
+        RunChunks(*loop);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --busy_;
+      }
+      done_.notify_one();
+    }
+  }
+
+  static void RunChunks(Loop &loop) {
+    for (size_t chunk = loop.next_chunk.fetch_add(1); chunk < loop.chunk_count;
+         chunk = loop.next_chunk.fetch_add(1))
+      (*loop.body)(chunk);
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+
+  // the running loop, if any
+  std::shared_ptr<Loop> loop_;
+  size_t generation_ = 0;
+  unsigned busy_ = 0;
+  bool stopping_ = false;
+};
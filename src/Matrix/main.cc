@@ -1,5 +1,3 @@
-#define GLFW_INCLUDE_NONE
-#include <GLFW/glfw3.h>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -9,6 +7,9 @@
 #include <memory>
 #include <vector>
 
+#include "context.h"
+#include "program_cache.h"
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 const int WINDOW_WIDTH = 600;
@@ -48,68 +49,16 @@ void main() {
 }
 )##";
 
-void HandleGLFWError(int error, const char *description) {
-  spdlog::error("GLFW Error: {}", description);
-}
-
-void LogShaderInfo(GLuint shader_id) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char buffer[2048];
-  glGetShaderInfoLog(shader_id, max_length, &actual_length, buffer);
-  spdlog::error("shader info log for GL index {}:\n{}", shader_id, buffer);
-}
-
-void LogProgramInfo(GLuint program) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char program_log[2048];
-  glGetProgramInfoLog(program, max_length, &actual_length, program_log);
-  spdlog::error("program info log for GL index {}:\n{}", program, program_log);
-}
-
-int main() {
-  glfwSetErrorCallback(HandleGLFWError);
-
-  // start GL context and O/S window using the GLFW helper library
-  if (!glfwInit()) {
-    spdlog::error("could not start GLFW3");
+int main(int argc, char **argv) {
+  ContextOptions options;
+  options.width = WINDOW_WIDTH;
+  options.height = WINDOW_HEIGHT;
+  if (!ParseContextOptions(argc, argv, options))
     return 1;
-  }
-
-  // Anti-Aliasing
-  glfwWindowHint(GLFW_SAMPLES, 4);
-
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  GLFWwindow *window =
-      glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Hello Matrix", NULL, NULL);
-
-  // Full-Screen
-  // GLFWmonitor *monitor = glfwGetPrimaryMonitor();
-  // const GLFWvidmode *vmode = glfwGetVideoMode(monitor);
-  // GLFWwindow *window = glfwCreateWindow(vmode->width, vmode->height,
-  //                                       "Extended GL Init", monitor, NULL);
 
-  if (!window) {
-    spdlog::error("could not open window with GLFW3");
-    glfwTerminate();
+  auto context = Context::Create(options, "Hello Matrix");
+  if (!context)
     return 1;
-  }
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1); // Enable vsync
-
-  if (!gladLoadGL()) {
-    spdlog::error("failed to initialize OpenGL loader");
-    return 1;
-  }
-
-  // get version info
-  spdlog::info("Renderer: {}", glGetString(GL_RENDERER));
-  spdlog::info("OpenGL version supported: {}", glGetString(GL_VERSION));
 
   // tell GL to only draw onto a pixel if the shape is closer to the viewer
   glEnable(GL_DEPTH_TEST); // enable depth-testing
@@ -130,6 +79,7 @@ int main() {
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
   glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0],
                GL_STATIC_DRAW);
+  LabelObject(GL_BUFFER, vbo, "matrix vertices");
 
   GLuint vao = 0;
   glGenVertexArrays(1, &vao);
@@ -140,37 +90,13 @@ int main() {
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 24, BUFFER_OFFSET(0));
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 24, BUFFER_OFFSET(12));
 
-  int params = -1;
-  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader);
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", vertex_shader);
-    LogShaderInfo(vertex_shader);
-    return 1; // or exit or something
-  }
-
-  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", fragment_shader);
-    LogShaderInfo(fragment_shader);
-    return 1; // or exit or something
-  }
-
-  GLuint program = glCreateProgram();
-  glAttachShader(program, fragment_shader);
-  glAttachShader(program, vertex_shader);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("could not link shader program GL index {}", program);
-    LogProgramInfo(program);
+  ProgramCache programs;
+  GLuint program =
+      programs.Get({{GL_VERTEX_SHADER, vertex_shader_source},
+                    {GL_FRAGMENT_SHADER, fragment_shader_source}});
+  if (!program)
     return 1;
-  }
+  LabelObject(GL_PROGRAM, program, "matrix");
 
   GLuint uniform_mvp = glGetUniformLocation(program, "MVP");
 
@@ -179,40 +105,26 @@ int main() {
   glm::vec3 up_vector(0.0f, 1.0f, 0.0f);
   glm::mat4 view = glm::lookAt(camera_position, camera_target, up_vector);
   glm::mat4 projection = glm::perspective(
-      glm::radians(45.0f), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f,
+      glm::radians(45.0f), (float)options.width / (float)options.height, 0.1f,
       100.0f);
   float angular_velocity = glm::pi<float>() * 2.0f;
 
-  while (!glfwWindowShouldClose(window)) {
-    double time = glfwGetTime();
+  RenderState &state = context->state();
+  while (!context->ShouldClose()) {
+    double time = context->Time();
     float angle = angular_velocity * time;
     glm::mat4 model = glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
 
     // wipe the drawing surface clear
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(program);
+    state.UseProgram(program);
     auto mvp = projection * view * model;
-    glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, &mvp[0][0]);
-    glBindVertexArray(vao);
+    state.UniformMatrix4fv(uniform_mvp, &mvp[0][0]);
+    state.BindVertexArray(vao);
     // draw points 0-3 from the currently bound VAO with current in-use shader
     glDrawArrays(GL_TRIANGLES, 0, 3);
-    // put the stuff we've been drawing onto the display
-    glfwSwapBuffers(window);
-    // update other events like input handling
-    glfwPollEvents();
-
-    if (GLFW_PRESS == glfwGetKey(window, GLFW_KEY_ESCAPE)) {
-      glfwSetWindowShouldClose(window, 1);
-    }
+    context->EndFrame();
   }
 
-  glDetachShader(program, vertex_shader);
-  glDetachShader(program, fragment_shader);
-
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
-
-  // close GL context and any other GLFW resources
-  glfwTerminate();
   return 0;
 }
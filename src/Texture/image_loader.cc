@@ -0,0 +1,151 @@
+#include "image_loader.h"
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+
+#include "ktx_file.h"
+
+namespace {
+// the metadata key of the image a cache was made from
+const char kSourceKey[] = "gltest.source";
+
+// Identifies the contents of `path` without reading it.
+std::string SourceStamp(const std::string &path) {
+  std::error_code error;
+  auto size = std::filesystem::file_size(path, error);
+  auto modified = std::filesystem::last_write_time(path, error);
+  return fmt::format("{} bytes, modified at {}", size,
+                     modified.time_since_epoch().count());
+}
+} // namespace
+
+ImageLoader::ImageLoader(std::vector<std::string> paths,
+                         std::vector<std::optional<BlockFormat>> compression,
+                         unsigned thread_count)
+    : paths_(std::move(paths)), compression_(std::move(compression)),
+      start_(Clock::now()), last_decode_(start_) {
+  thread_count = std::max(1u, std::min<unsigned>(thread_count, paths_.size()));
+  for (unsigned i = 0; i < thread_count && !paths_.empty(); ++i)
+    workers_.emplace_back([this] { Work(); });
+}
+
+ImageLoader::~ImageLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  taken_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+void ImageLoader::Work() {
+  for (;;) {
+    size_t file = next_file_.fetch_add(1);
+    if (file >= paths_.size())
+      return;
+
+    auto start = Clock::now();
+    Image image;
+    image.file = file;
+    const std::string &path = paths_[file];
+    // null for images kept as pixels
+    const BlockFormat *format =
+        file < compression_.size() && compression_[file]
+            ? &*compression_[file]
+            : nullptr;
+    if (!format || !ReadCache(path, *format, &image)) {
+      // blocks are encoded from RGBA whatever the image has
+      image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height,
+                                   &image.channels, format ? 4 : 0));
+      if (image.pixels) {
+        std::error_code error;
+        file_bytes_ += std::filesystem::file_size(path, error);
+        decoded_bytes_ += uint64_t(image.width) * image.height *
+                          (format ? 4 : image.channels);
+        if (format)
+          Compress(path, *format, &image);
+      } else {
+        spdlog::error("could not read image {}: {}", path,
+                      stbi_failure_reason());
+      }
+    }
+
+    auto end = Clock::now();
+    busy_nanoseconds_ +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    last_decode_ = std::max(last_decode_, end);
+    taken_.wait(lock,
+                [this] { return stopping_ || ready_.size() < kMaxReady; });
+    if (stopping_)
+      return;
+    ready_.push_back(std::move(image));
+  }
+}
+
+void ImageLoader::Take(std::vector<Image> *images) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ready_.empty())
+      return;
+    taken_count_ += ready_.size();
+    for (Image &image : ready_)
+      images->push_back(std::move(image));
+    ready_.clear();
+  }
+  taken_.notify_all();
+}
+
+bool ImageLoader::done() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return taken_count_ == paths_.size();
+}
+
+double ImageLoader::decode_seconds() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::chrono::duration<double>(last_decode_ - start_).count();
+}
+
+bool ImageLoader::ReadCache(const std::string &path, BlockFormat format,
+                            Image *image) {
+  std::string cache = path + ".ktx2";
+  std::map<std::string, std::string> metadata;
+  if (!ReadKtx2(cache, &image->compressed, &metadata))
+    return false;
+  if (image->compressed.format != format ||
+      metadata[kSourceKey] != SourceStamp(path)) {
+    image->compressed = {};
+    return false;
+  }
+  image->width = image->compressed.width;
+  image->height = image->compressed.height;
+  image->channels = BlockChannels(format);
+  std::error_code error;
+  file_bytes_ += std::filesystem::file_size(cache, error);
+  block_bytes_ += image->compressed.data.size();
+  ++cached_count_;
+  return true;
+}
+
+void ImageLoader::Compress(const std::string &path, BlockFormat format,
+                           Image *image) {
+  auto start = Clock::now();
+  image->compressed = CompressMipChain(format, image->pixels.get(),
+                                       image->width, image->height);
+  image->pixels.reset();
+  image->channels = BlockChannels(format);
+  encode_nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             Clock::now() - start)
+                             .count();
+  block_bytes_ += image->compressed.data.size();
+  ++encoded_count_;
+  WriteKtx2(path + ".ktx2", image->compressed,
+            {{kSourceKey, SourceStamp(path)}});
+}
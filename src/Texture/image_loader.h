@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stb_image.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "block_compression.h"
+
+// Decodes image files with stb_image on worker threads, so the render
+// thread never waits for a decode. Workers take the files in order and
+// hand finished images to the render thread, which collects them with
+// Take once per frame. At most kMaxReady images wait to be taken; workers
+// pause while that many do, which bounds the memory held by a render
+// thread that uploads slower than the workers decode.
+//
+// Images can also be block compressed on the workers. The blocks of each
+// are cached in a KTX2 file next to it, the image's path plus ".ktx2", and
+// later runs read them from there instead of decoding and encoding again,
+// as long as the image's size and modification time are the ones the
+// cache was made from and it holds the same format.
+class ImageLoader {
+public:
+  static constexpr size_t kMaxReady = 16;
+
+  struct Image {
+    // index of the file in the list given to the loader
+    size_t file;
+    int width = 0;
+    int height = 0;
+    // of the pixels, or that the blocks decode to
+    int channels = 0;
+    // null if the file could not be decoded or was compressed
+    std::unique_ptr<unsigned char, decltype(&stbi_image_free)> pixels{
+        nullptr, stbi_image_free};
+    // the blocks of every mip level, if the file was compressed
+    CompressedImage compressed;
+
+    // What TextureManager::Upload takes, or null if there is nothing.
+    const void *data() const {
+      if (pixels)
+        return pixels.get();
+      return compressed.data.empty() ? nullptr : compressed.data.data();
+    }
+  };
+
+  // Starts decoding `paths` on `thread_count` threads. Decoding uses the
+  // global stb_image settings, which must not change until done(), and
+  // which the cache does not record. If `compression` is given, it has an
+  // entry per path, and file i is compressed to compression[i] if set.
+  explicit ImageLoader(
+      std::vector<std::string> paths,
+      std::vector<std::optional<BlockFormat>> compression = {},
+      unsigned thread_count = std::thread::hardware_concurrency());
+  // Stops once the images being decoded are finished.
+  ~ImageLoader();
+
+  ImageLoader(const ImageLoader &) = delete;
+  ImageLoader &operator=(const ImageLoader &) = delete;
+
+  // Appends the images decoded since the last call to `images`.
+  void Take(std::vector<Image> *images);
+
+  // True once every file has been decoded and taken.
+  bool done() const;
+
+  unsigned thread_count() const { return workers_.size(); }
+  // Files read and pixels decoded so far, in bytes; the time from the start
+  // until the last decode finished, which includes pauses while images
+  // waited to be taken; and the time the workers spent decoding, summed.
+  uint64_t file_bytes() const { return file_bytes_; }
+  uint64_t decoded_bytes() const { return decoded_bytes_; }
+  double decode_seconds() const;
+  double busy_seconds() const { return busy_nanoseconds_ * 1e-9; }
+  // Images read from the cache, and images compressed and the time the
+  // workers spent on that, summed; and the bytes of blocks of both.
+  size_t cached_count() const { return cached_count_; }
+  size_t encoded_count() const { return encoded_count_; }
+  double encode_seconds() const { return encode_nanoseconds_ * 1e-9; }
+  uint64_t block_bytes() const { return block_bytes_; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  void Work();
+  // Fills `image` from the cache of `path` if it is current.
+  bool ReadCache(const std::string &path, BlockFormat format, Image *image);
+  void Compress(const std::string &path, BlockFormat format, Image *image);
+
+  std::vector<std::string> paths_;
+  std::vector<std::optional<BlockFormat>> compression_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_file_{0};
+
+  mutable std::mutex mutex_;
+  std::condition_variable taken_;
+  std::deque<Image> ready_;
+  size_t taken_count_ = 0;
+  bool stopping_ = false;
+
+  Clock::time_point start_;
+  Clock::time_point last_decode_;
+  std::atomic<uint64_t> file_bytes_{0};
+  std::atomic<uint64_t> decoded_bytes_{0};
+  std::atomic<uint64_t> busy_nanoseconds_{0};
+  std::atomic<size_t> cached_count_{0};
+  std::atomic<size_t> encoded_count_{0};
+  std::atomic<uint64_t> encode_nanoseconds_{0};
+  std::atomic<uint64_t> block_bytes_{0};
+};
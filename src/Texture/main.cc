@@ -1,15 +1,28 @@
-#define GLFW_INCLUDE_NONE
-#include <GLFW/glfw3.h>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <spdlog/spdlog.h>
 #include <stb_image.h>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
+#include "block_compression.h"
+#include "context.h"
+#include "image_loader.h"
+#include "program_cache.h"
+#include "texture_manager.h"
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 const int WINDOW_WIDTH = 600;
@@ -32,111 +45,197 @@ std::vector<GLushort> indices = {
     1, 2, 3  // second triangle
 };
 
+// Every quad is an instance with its own place on the grid and texture.
 const char *vertex_shader_source = u8R"##(#version 400
 layout(location = 0) in vec3 vertex_position;
 layout(location = 1) in vec2 vertex_texcoord;
+// x, y offset and scale
+layout(location = 2) in vec3 instance_placement;
+layout(location = 3) in uint instance_texture;
 
 out vec2 texcoord;
+flat out uint texture_index;
 
 uniform mat4 MVP;
 
 void main() {
   texcoord = vertex_texcoord;
-  gl_Position = MVP * vec4(vertex_position, 1.0);
+  texture_index = instance_texture;
+  vec3 position = vertex_position * instance_placement.z +
+                  vec3(instance_placement.xy, 0.0);
+  gl_Position = MVP * vec4(position, 1.0);
 }
 )##";
 
+// The table of TextureManager, with the layer of each texture in .z.
 const char *fragment_shader_source = u8R"##(#version 400
 in vec2 texcoord;
+flat in uint texture_index;
 out vec4 frag_color;
 
-uniform sampler2D texture0;
+layout(std140) uniform Textures { uvec4 textures[1024]; };
+uniform sampler2DArray texture_array;
 
 void main() {
-  frag_color = texture2D(texture0, texcoord);
+  float layer = textures[texture_index].z;
+  frag_color = texture(texture_array, vec3(texcoord, layer));
 }
 )##";
 
-void HandleGLFWError(int error, const char *description) {
-  spdlog::error("GLFW Error: {}", description);
-}
+// The same with the array's bindless handle in .xy, so nothing is bound.
+const char *bindless_fragment_shader_source = u8R"##(#version 400
+#extension GL_ARB_bindless_texture : require
+in vec2 texcoord;
+flat in uint texture_index;
+out vec4 frag_color;
 
-void LogShaderInfo(GLuint shader_id) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char buffer[2048];
-  glGetShaderInfoLog(shader_id, max_length, &actual_length, buffer);
-  spdlog::error("shader info log for GL index {}:\n{}", shader_id, buffer);
-}
+layout(std140) uniform Textures { uvec4 textures[1024]; };
 
-void LogProgramInfo(GLuint program) {
-  int max_length = 2048;
-  int actual_length = 0;
-  char program_log[2048];
-  glGetProgramInfoLog(program, max_length, &actual_length, program_log);
-  spdlog::error("program info log for GL index {}:\n{}", program, program_log);
+void main() {
+  uvec4 texture_entry = textures[texture_index];
+  frag_color = texture(sampler2DArray(texture_entry.xy),
+                       vec3(texcoord, texture_entry.z));
 }
+)##";
 
-int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " FILENAME" << std::endl;
-    return 1;
-  }
+const GLuint TEXTURES_BINDING = 0;
 
-  stbi_set_flip_vertically_on_load(true);
+struct Instance {
+  glm::vec3 placement;
+  GLuint texture;
+};
 
-  int image_width, image_height, image_nchannel;
-  std::unique_ptr<unsigned char, decltype(&stbi_image_free)> image_data(
-      stbi_load(argv[1], &image_width, &image_height, &image_nchannel, 0),
-      stbi_image_free);
+// Instances drawn together because their textures share an array.
+struct Batch {
+  int array;
+  GLuint first;
+  GLsizei count;
+};
 
-  if ((!image_data) || (0 >= image_width) || (0 >= image_height) ||
-      (0 >= image_nchannel)) {
-    spdlog::error("could not read image");
-    return 1;
+// what stb_image decodes, judged by the extension
+const char *IMAGE_EXTENSIONS[] = {".png", ".jpg", ".jpeg", ".bmp", ".tga",
+                                  ".gif", ".psd", ".hdr", ".pic", ".pnm",
+                                  ".ppm", ".pgm"};
+
+// Replaces directories with the images in them, in name order.
+std::vector<std::string> ExpandPaths(const std::vector<std::string> &paths) {
+  std::vector<std::string> files;
+  for (auto &path : paths) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(path, error)) {
+      files.push_back(path);
+      continue;
+    }
+    std::vector<std::string> images;
+    for (auto &entry : std::filesystem::directory_iterator(path, error)) {
+      std::string extension = entry.path().extension().string();
+      for (char &c : extension)
+        c = std::tolower((unsigned char)c);
+      if (entry.is_regular_file(error) &&
+          std::find_if(std::begin(IMAGE_EXTENSIONS),
+                       std::end(IMAGE_EXTENSIONS), [&](const char *known) {
+                         return extension == known;
+                       }) != std::end(IMAGE_EXTENSIONS))
+        images.push_back(entry.path().string());
+    }
+    if (images.empty())
+      spdlog::warn("no images in {}", path);
+    std::sort(images.begin(), images.end());
+    files.insert(files.end(), images.begin(), images.end());
   }
+  return files;
+}
 
-  glfwSetErrorCallback(HandleGLFWError);
-
-  // start GL context and O/S window using the GLFW helper library
-  if (!glfwInit()) {
-    spdlog::error("could not start GLFW3");
-    return 1;
+// Picks the quads of `grid` whose textures have arrived and orders them by
+// array, so each array is one instanced draw.
+void Arrange(const std::vector<Instance> &grid,
+             const std::vector<bool> &loaded, const TextureManager &textures,
+             std::vector<Instance> *instances, std::vector<Batch> *batches) {
+  instances->clear();
+  for (const Instance &instance : grid)
+    if (loaded[instance.texture])
+      instances->push_back(instance);
+  std::stable_sort(instances->begin(), instances->end(),
+                   [&textures](const Instance &a, const Instance &b) {
+                     return textures.entry(a.texture).array <
+                            textures.entry(b.texture).array;
+                   });
+  batches->clear();
+  for (size_t i = 0; i < instances->size(); ++i) {
+    int array = textures.entry((*instances)[i].texture).array;
+    if (batches->empty() || batches->back().array != array)
+      batches->push_back({array, GLuint(i), 0});
+    ++batches->back().count;
   }
+}
 
-  // Anti-Aliasing
-  glfwWindowHint(GLFW_SAMPLES, 4);
-
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  GLFWwindow *window =
-      glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Hello Matrix", NULL, NULL);
+// The bytes of a full mip chain of uncompressed pixels.
+size_t MipChainBytes(int width, int height, int channels) {
+  size_t bytes = 0;
+  for (int level = 0; level < MipLevelCount(width, height); ++level)
+    bytes += size_t(std::max(1, width >> level)) *
+             std::max(1, height >> level) * channels;
+  return bytes;
+}
 
-  // Full-Screen
-  // GLFWmonitor *monitor = glfwGetPrimaryMonitor();
-  // const GLFWvidmode *vmode = glfwGetVideoMode(monitor);
-  // GLFWwindow *window = glfwCreateWindow(vmode->width, vmode->height,
-  //                                       "Extended GL Init", monitor, NULL);
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
 
-  if (!window) {
-    spdlog::error("could not open window with GLFW3");
-    glfwTerminate();
+int main(int argc, char **argv) {
+  auto start_time = std::chrono::steady_clock::now();
+  ContextOptions options;
+  options.width = WINDOW_WIDTH;
+  options.height = WINDOW_HEIGHT;
+  if (!ParseContextOptions(argc, argv, options))
     return 1;
-  }
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1); // Enable vsync
 
-  if (!gladLoadGL()) {
-    spdlog::error("failed to initialize OpenGL loader");
+  int quad_count = 0;
+  bool bindless = true;
+  // with compression and no format, BC1 for opaque images and BC3 for the
+  // rest
+  bool compress = false;
+  std::optional<BlockFormat> compress_format;
+  std::vector<std::string> filenames;
+  for (int i = 1; i < argc; ++i) {
+    if (std::sscanf(argv[i], "--quads=%d", &quad_count) == 1 &&
+        quad_count > 0) {
+      continue;
+    } else if (std::strcmp(argv[i], "--no-bindless") == 0) {
+      bindless = false;
+    } else if (std::strcmp(argv[i], "--compress=auto") == 0) {
+      compress = true;
+    } else if (std::strcmp(argv[i], "--compress=bc1") == 0) {
+      compress = true;
+      compress_format = BlockFormat::kBC1;
+    } else if (std::strcmp(argv[i], "--compress=bc3") == 0) {
+      compress = true;
+      compress_format = BlockFormat::kBC3;
+    } else if (std::strcmp(argv[i], "--compress=bc7") == 0) {
+      compress = true;
+      compress_format = BlockFormat::kBC7;
+    } else if (argv[i][0] != '-') {
+      filenames.push_back(argv[i]);
+    } else {
+      filenames.clear();
+      break;
+    }
+  }
+  if (filenames.empty()) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--headless] [--size=WxH] [--frames=N] [--quads=N] "
+                 "[--no-bindless] [--compress=auto|bc1|bc3|bc7] "
+                 "FILE_OR_DIRECTORY..."
+              << std::endl;
     return 1;
   }
+  std::vector<std::string> paths = ExpandPaths(filenames);
 
-  // get version info
-  spdlog::info("Renderer: {}", glGetString(GL_RENDERER));
-  spdlog::info("OpenGL version supported: {}", glGetString(GL_VERSION));
+  auto context = Context::Create(options, "Hello Matrix");
+  if (!context)
+    return 1;
 
   // tell GL to only draw onto a pixel if the shape is closer to the viewer
   glEnable(GL_DEPTH_TEST); // enable depth-testing
@@ -151,11 +250,68 @@ int main(int argc, char **argv) {
   //              /* GLfloat blue  = */ 0.2f,
   //              /* GLfloat alpha = */ 0.0f);
 
+  stbi_set_flip_vertically_on_load(true);
+
+  if (compress &&
+      !(compress_format
+            ? TextureManager::Supports(*compress_format)
+            : TextureManager::Supports(BlockFormat::kBC1) &&
+                  TextureManager::Supports(BlockFormat::kBC3))) {
+    spdlog::warn("{} textures are not supported, uploading pixels",
+                 compress_format ? BlockFormatName(*compress_format)
+                                 : "BC1 and BC3");
+    compress = false;
+  }
+
+  // only the headers are read up front, which is enough to allocate the
+  // arrays; the pixels are decoded in the background and streamed in as
+  // they arrive, so the first frame does not wait for them. Compressed
+  // images are encoded there too, or read from the KTX2 file an earlier
+  // run left next to them, which skips decoding altogether.
+  TextureManager textures(bindless);
+  std::vector<std::string> texture_paths;
+  std::vector<std::optional<BlockFormat>> compression;
+  // of the textures as uncompressed pixels, for comparison
+  size_t pixel_bytes = 0;
+  for (auto &path : paths) {
+    int image_width, image_height, image_nchannel;
+    if (!stbi_info(path.c_str(), &image_width, &image_height,
+                   &image_nchannel)) {
+      spdlog::error("could not read image {}: {}", path,
+                    stbi_failure_reason());
+      continue;
+    }
+    std::optional<BlockFormat> format;
+    if (compress)
+      format = compress_format ? *compress_format
+               : image_nchannel % 2 == 1 ? BlockFormat::kBC1
+                                         : BlockFormat::kBC3;
+    if ((format ? textures.Reserve(image_width, image_height, *format)
+                : textures.Reserve(image_width, image_height,
+                                   image_nchannel)) < 0)
+      return 1;
+    texture_paths.push_back(path);
+    compression.push_back(format);
+    pixel_bytes += MipChainBytes(image_width, image_height, image_nchannel);
+  }
+  int texture_count = texture_paths.size();
+  if (texture_count == 0)
+    return 1;
+  // texture i is decoded from file i
+  ImageLoader loader(texture_paths, compression);
+  textures.Update();
+  spdlog::info("decoding {} images on {} threads", texture_count,
+               loader.thread_count());
+  // one quad per image unless asked for more, cycling through the images
+  if (quad_count == 0)
+    quad_count = texture_count;
+
   GLuint vbo = 0;
   glGenBuffers(1, &vbo);
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0],
                GL_STATIC_DRAW);
+  LabelObject(GL_BUFFER, vbo, "quad vertices");
 
   GLuint vao = 0;
   glGenVertexArrays(1, &vao);
@@ -173,85 +329,153 @@ int main(int argc, char **argv) {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(),
                &indices[0], GL_STATIC_DRAW);
-
-  GLuint texture = 0;
-  glGenTextures(1, &texture);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image_width, image_height, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, image_data.get());
-  glGenerateMipmap(GL_TEXTURE_2D);
-
-  int params = -1;
-  GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-  glCompileShader(vertex_shader);
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", vertex_shader);
-    LogShaderInfo(vertex_shader);
-    return 1; // or exit or something
-  }
-
-  GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("GL shader index {} did not compile", fragment_shader);
-    LogShaderInfo(fragment_shader);
-    return 1; // or exit or something
+  LabelObject(GL_BUFFER, ebo, "quad indices");
+
+  // lay the quads out on a square grid; each is drawn once its texture
+  // has arrived
+  int side = std::ceil(std::sqrt((double)quad_count));
+  float cell = 2.0f / side;
+  std::vector<Instance> grid(quad_count);
+  for (int i = 0; i < quad_count; ++i) {
+    float x = (i % side - 0.5f * (side - 1)) * cell;
+    float y = (0.5f * (side - 1) - i / side) * cell;
+    grid[i] = {glm::vec3(x, y, 0.5f * cell), GLuint(i % texture_count)};
   }
-
-  GLuint program = glCreateProgram();
-  glAttachShader(program, fragment_shader);
-  glAttachShader(program, vertex_shader);
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &params);
-  if (GL_TRUE != params) {
-    spdlog::error("could not link shader program GL index {}", program);
-    LogProgramInfo(program);
+  std::vector<bool> loaded(texture_count, false);
+  std::vector<Instance> instances;
+  std::vector<Batch> batches;
+
+  GLuint instance_vbo = 0;
+  glGenBuffers(1, &instance_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * grid.size(), nullptr,
+               GL_DYNAMIC_DRAW);
+  LabelObject(GL_BUFFER, instance_vbo, "quad instances");
+  glEnableVertexAttribArray(2);
+  glEnableVertexAttribArray(3);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                        BUFFER_OFFSET(0));
+  glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(Instance),
+                         BUFFER_OFFSET(12));
+  glVertexAttribDivisor(2, 1);
+  glVertexAttribDivisor(3, 1);
+
+  ProgramCache programs;
+  GLuint program = programs.Get(
+      {{GL_VERTEX_SHADER, vertex_shader_source},
+       {GL_FRAGMENT_SHADER, textures.bindless()
+                                ? bindless_fragment_shader_source
+                                : fragment_shader_source}});
+  if (!program)
     return 1;
-  }
+  LabelObject(GL_PROGRAM, program, "textured quad");
 
   GLuint uniform_mvp = glGetUniformLocation(program, "MVP");
-  GLuint uniform_texture = glGetUniformLocation(program, "texture0");
+  GLint uniform_texture = glGetUniformLocation(program, "texture_array");
+  glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Textures"),
+                        TEXTURES_BINDING);
 
-  glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-  float aspect_ratio = WINDOW_WIDTH / (float)WINDOW_HEIGHT;
+  spdlog::info("{} quads with {} textures in {} arrays, {}", quad_count,
+               texture_count, textures.array_count(),
+               textures.bindless() ? "bindless" : "binding texture arrays");
+
+  glViewport(0, 0, options.width, options.height);
+  float aspect_ratio = options.width / (float)options.height;
   glm::mat4 view = glm::ortho(-1.0f * aspect_ratio, 1.0f * aspect_ratio, -1.0f,
                               1.0f, -100.0f, 100.0f);
   glm::mat4 mvp = view;
-  while (!glfwWindowShouldClose(window)) {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(program);
-    glUniformMatrix4fv(uniform_mvp, 1, GL_FALSE, &mvp[0][0]);
-    glUniform1i(uniform_texture, texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    // glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-
-    // put the stuff we've been drawing onto the display
-    glfwSwapBuffers(window);
-    // update other events like input handling
-    glfwPollEvents();
-
-    if (GLFW_PRESS == glfwGetKey(window, GLFW_KEY_ESCAPE)) {
-      glfwSetWindowShouldClose(window, 1);
+  FrameProfiler &profiler = context->profiler();
+  // nothing changes between frames, so only the first one sets any state
+  RenderState &state = context->state();
+  // taken from the loader but not staged yet
+  std::vector<ImageLoader::Image> arrived;
+  bool first_frame = true;
+  bool all_arrived = false;
+  while (!context->ShouldClose()) {
+    profiler.Begin("upload");
+    loader.Take(&arrived);
+    size_t staged = 0;
+    for (; staged < arrived.size(); ++staged) {
+      ImageLoader::Image &image = arrived[staged];
+      if (!image.data())
+        continue;
+      // a file that changed since its header was read
+      const TextureManager::Format &format =
+          textures.format(textures.entry(image.file).array);
+      if (image.width != format.width || image.height != format.height ||
+          image.channels != format.channels) {
+        spdlog::error("image {} changed while loading",
+                      texture_paths[image.file]);
+        continue;
+      }
+      if (!textures.Upload(image.file, image.data()))
+        break;
+      loaded[image.file] = true;
     }
-  }
+    arrived.erase(arrived.begin(), arrived.begin() + staged);
+    if (textures.FlushUploads() > 0) {
+      // uploading bound textures and pixel buffers behind its back
+      state.Invalidate();
+      Arrange(grid, loaded, textures, &instances, &batches);
+      state.BindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(Instance) * instances.size(),
+                      instances.data());
+    }
+    if (!all_arrived && loader.done() && arrived.empty()) {
+      all_arrived = true;
+      double seconds = loader.decode_seconds();
+      spdlog::info("all textures arrived after {:.1f} ms; {} draws",
+                   MillisecondsSince(start_time), batches.size());
+      spdlog::info("decoded {:.1f} MB of pixels from {:.1f} MB of files in "
+                   "{:.1f} ms: {:.1f} MB/s, {:.1f} MB/s per busy thread",
+                   loader.decoded_bytes() * 1e-6, loader.file_bytes() * 1e-6,
+                   seconds * 1e3,
+                   seconds > 0.0 ? loader.decoded_bytes() * 1e-6 / seconds
+                                 : 0.0,
+                   loader.busy_seconds() > 0.0
+                       ? loader.decoded_bytes() * 1e-6 / loader.busy_seconds()
+                       : 0.0);
+      if (compress) {
+        double encode_seconds = loader.encode_seconds();
+        spdlog::info("compressed {} images in {:.1f} ms of worker time "
+                     "({:.1f} MB/s of pixels), read {} from KTX2 caches",
+                     loader.encoded_count(), encode_seconds * 1e3,
+                     encode_seconds > 0.0
+                         ? loader.decoded_bytes() * 1e-6 / encode_seconds
+                         : 0.0,
+                     loader.cached_count());
+        spdlog::info("{:.1f} MB of blocks instead of {:.1f} MB of pixels",
+                     loader.block_bytes() * 1e-6, pixel_bytes * 1e-6);
+      }
+    }
+    // drawn on demand, frames keep coming until every texture is in
+    if (!all_arrived)
+      context->RequestRedraw();
 
-  glDetachShader(program, vertex_shader);
-  glDetachShader(program, fragment_shader);
+    profiler.Begin("clear");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    profiler.Begin("draw");
+    state.UseProgram(program);
+    state.UniformMatrix4fv(uniform_mvp, &mvp[0][0]);
+    // the sampler takes the texture unit, not the texture
+    state.Uniform1i(uniform_texture, 0);
+    state.BindBufferRange(GL_UNIFORM_BUFFER, TEXTURES_BINDING,
+                          textures.table(), 0, TextureManager::table_size());
+    state.BindVertexArray(vao);
+    for (const Batch &batch : batches) {
+      if (!textures.bindless())
+        state.BindTexture(0, GL_TEXTURE_2D_ARRAY, textures.array(batch.array));
+      glDrawElementsInstancedBaseInstance(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT,
+                                          0, batch.count, batch.first);
+    }
 
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+    context->EndFrame();
+    if (first_frame) {
+      first_frame = false;
+      spdlog::info("first frame after {:.1f} ms",
+                   MillisecondsSince(start_time));
+    }
+  }
 
-  // close GL context and any other GLFW resources
-  glfwTerminate();
   return 0;
 }